@@ -1,6 +1,11 @@
 #ifndef AVL_TREE_H
 #define AVL_TREE_H
-
+#include <algorithm>
+#include <vector>
+#include "NodeReclaimer.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include "TreeUtils.h"
 
 namespace myDataStructures
 {
@@ -9,7 +14,7 @@ namespace myDataStructures
 		template<typename T>
 		struct Node
 		{
-			Node(T key) : key(key)
+			Node(T key) : key(key), left(nullptr), right(nullptr), height(1), dirty(0), count(1)
 			{
 
 			}
@@ -18,6 +23,10 @@ namespace myDataStructures
 			Node<T>* right;
 			unsigned char height; // It is pretty legal to use 1 byte. Because of the fact that to overflow the limit of byte the height must be over than 255. 
 								  // Which means to have more keys than - 57896044618658097711785492504343953926634992332820282019728792003956564819968.
+			unsigned char dirty; // Set on the path of every relaxed insert or remove, meaning height may be stale until Rebalance
+			unsigned int count; // Copies of key, above 1 only in multiset mode. Fits in the padding after height.
+
+			static const unsigned int MaxCount = 0xFFFFFFFF; // Largest count, further copies are not counted
 		};
 
 		template<typename T>
@@ -25,6 +34,24 @@ namespace myDataStructures
 		{
 		private:
 			Node<T>* root;
+			Node<T>* leftmost; // Cached extremes, nullptr only when the tree is empty
+			Node<T>* rightmost;
+			size_t size;
+			bool multiset;
+			bool relaxed;
+			bool backgroundFree;
+			std::vector<Node<T>*> levelBuffer; // Reused by every level order walk, so it only allocates while it grows
+			std::vector<Node<T>*> pathBuffer; // Ancestors of a relaxed insert that went too deep
+			std::vector<Node<T>*> rebuildBuffer; // Nodes of the subtree a relaxed insert rebuilds, in key order
+			std::vector<Node<T>*> upperBuffer; // Its nodes above the new one while they are gathered
+			// Relaxed inserts past the extreme the previous one added form a run, kept as a spine of nodes whose
+			// inner subtrees are perfect trees of decreasing height, like the digits of a binary counter.
+			// The spine nodes' height holds the height of the node with its inner subtree only.
+			std::vector<Node<T>*> runSpine; // From the top of the run down to the extreme added last, empty when there is no run
+			Node<T>** runLink; // Link holding runSpine[0]
+			size_t runDepth; // Depth of runSpine[0]
+			bool runRight; // Whether the run grows to the right, past the largest key
+			size_t relaxedPeak; // Largest size since the tree was last balanced as a whole, bounds the depth of relaxed trees
 
 		protected:
 
@@ -34,22 +61,131 @@ namespace myDataStructures
 			Node<T>* Balance(Node<T>* n);
 			Node<T>* RightRotation(Node<T>* &n);
 			Node<T>* LeftRotation(Node<T>* &n);
-			Node<T>* Insert(T v, Node<T>* n);
+			Node<T>* Insert(T v, Node<T>* n, unsigned int copies);
 			Node<T>* Remove(T v, Node<T>* n);
 			Node<T>* FindMin(Node<T>* n);
 			Node<T>* FindMax(Node<T>* n);
-			void* PopMax(Node<T>* n);
+			Node<T>* Locate(T v);
+			Node<T>* RemoveMin(Node<T>* n, Node<T>* parent);
+			Node<T>* RemoveMax(Node<T>* n, Node<T>* parent);
+			void RestoreExtremes();
+			void InsertKey(T v, unsigned int copies);
+			void RemoveKey(T v);
+			void RelaxedInsert(T v, unsigned int copies);
+			void RelaxedRemove(T v);
+			bool AppendToRun(T v, unsigned int copies);
+			void RebuildScapegoat(Node<T>* top);
+			void GatherSubtree(Node<T>* n, std::vector<Node<T>*>& nodes);
+			Node<T>* RebalanceDirty(Node<T>* n);
+			Node<T>* Join(Node<T>* left, Node<T>* pivot, Node<T>* right);
 			void Clear(Node<T>* n);
-			void InOrder(Node<T>* n);
+			Node<T>* BuildBalanced(std::vector<Node<T>*>& nodes, size_t lo, size_t hi);
+			Node<T>* BuildBalancedParallel(std::vector<Node<T>*>& nodes, size_t lo, size_t hi, unsigned splits);
+			Node<T>* CloneSubtree(const Node<T>* n) const;
+			Node<T>* CloneSubtreeParallel(const Node<T>* n, unsigned splits) const;
+
+			template<typename F>
+			void ForEachNodeInOrder(F&& f);
+			template<typename F>
+			void ForEachNodePreOrder(F&& f);
+			template<typename F>
+			void ForEachNodeLevelOrder(F&& f);
+			void CollectChunks(std::vector<TreeUtils::SubtreeChunk<Node<T>>>& chunks, unsigned threads);
+			void CollectChunks(Node<T>* n, unsigned char cutoff, std::vector<TreeUtils::SubtreeChunk<Node<T>>>& chunks);
 
 		public:
 
-			AVLTree();
+			// In multiset mode a repeated key raises the count of its node instead of being dropped
+			explicit AVLTree(bool multiset = false);
+			// Copies duplicate the shape node by node, keeping every height, so nothing is re-inserted
+			// or rebalanced. Moves only hand over the root and leave the source empty.
+			AVLTree(const AVLTree& other);
+			AVLTree(AVLTree&& other) noexcept;
+			AVLTree& operator=(const AVLTree& other);
+			AVLTree& operator=(AVLTree&& other) noexcept;
 			~AVLTree();
 
+			// Same as the copy constructor, with the subtrees below the top levels cloned on separate threads.
+			// Pass 0 threads to use the hardware concurrency.
+			AVLTree CloneParallel(unsigned threads = 0) const;
+
+			// With background freeing on, dropping the nodes in the destructor, Clear and assignments only
+			// hands the root to the NodeReclaimer thread, so even a huge tree goes away in O(1)
+			void SetBackgroundFree(bool backgroundFree);
+			// Removes every key
+			void Clear();
+
 			void Insert(T v);
 			void Remove(T v);
+
+			// In relaxed mode inserts and removes skip the rotations and only mark the nodes on their path.
+			// Keys arriving in order past the largest or smallest key are linked at the end of a run without a
+			// descent. An insert deeper than 2 + 2 log2(n) rebuilds its lowest unbalanced ancestor, and a remove
+			// leaving less than half of the largest size since the tree was last balanced rebuilds it whole, so
+			// reads stay within 4 + 2 log2(n). Rebalance() repairs the marked nodes, and leaving relaxed mode calls it.
+			// Sorted bursts gain the most. Random bursts insert faster, but the repair gives most of it back,
+			// so they only pay when Rebalance() can wait for a quiet moment.
+			void SetRelaxed(bool relaxed);
+			// Restores the AVL balance in O(marked nodes + rotations)
+			void Rebalance();
 			void Display();
+			size_t Size() const; // Distinct keys, each node counts once
+			Node<T>* Search(T v);
+
+			// Smallest and largest nodes in O(1), nullptr when the tree is empty
+			Node<T>* Min() const;
+			Node<T>* Max() const;
+			// Take the smallest or largest key out, one copy at a time in multiset mode.
+			// The new extreme is the neighbour of the removed node, so it is found without a walk.
+			// Return false when the tree is empty.
+			bool PopMin(T& key);
+			bool PopMax(T& key);
+
+			// Looks up many keys with their misses overlapped, results[i] is the node holding keys[i] or nullptr
+			void SearchBatch(const std::vector<T>& keys, std::vector<Node<T>*>& results);
+
+			// Copies of v, which stops growing at Node<T>::MaxCount (2^32 - 1)
+			unsigned int Count(T v);
+			bool EraseOne(T v);
+			unsigned int EraseAll(T v);
+
+			// Inserts a range of keys at once. Large batches are merged with the existing
+			// nodes in one in order pass and the tree is rebuilt, small ones are inserted in key order.
+			template<typename It>
+			void InsertBatch(It first, It last);
+
+			// Adds a large unsorted range using every core: a parallel sort, the new nodes allocated
+			// on every thread and subtrees linked concurrently.
+			// Pass 0 threads to use the hardware concurrency.
+			template<typename It>
+			void BuildParallel(It first, It last, unsigned threads = 0);
+
+			// Visitors receive each key and may return false to stop the walk early.
+			// In order and pre order walks use Morris threading, so they need no stack, but they
+			// temporarily rewire nodes: the visitor must not touch the tree, and nothing else may
+			// access it during the walk. The links are restored even if the visitor throws.
+			template<typename F>
+			void ForEachInOrder(F&& f);
+			template<typename F>
+			void ForEachPreOrder(F&& f);
+			template<typename F>
+			void ForEachLevelOrder(F&& f);
+			// Visits each distinct key in order together with its count
+			template<typename F>
+			void ForEachWithCount(F&& f);
+
+			// Parallel walks over every key on the shared task pool, with the tree cut into whole subtrees sized by height.
+			// f and op run on several threads at once, and the tree must not change meanwhile.
+			// Pass 0 threads to use the hardware concurrency.
+			template<typename F>
+			void ParallelForEach(F&& f, unsigned threads = 0);
+			// op folds a key into a partial result and merges two partial results, as with std::reduce.
+			// Partials merge in any order, so op must be commutative as well as associative.
+			template<typename R, typename Op>
+			R ParallelReduce(R identity, Op op, unsigned threads = 0);
+			// Merges the partials in order, for ops that are associative but not commutative
+			template<typename R, typename Op>
+			R ParallelReduceOrdered(R identity, Op op, unsigned threads = 0);
 		};
 
 		/////////////////////////
@@ -125,17 +261,27 @@ namespace myDataStructures
 		}
 
 		template<typename T>
-		Node<T>* AVLTree<T>::Insert(T v, Node<T>* n)
+		// copies is the count a new node starts with, or what a multiset adds to an existing one
+		Node<T>* AVLTree<T>::Insert(T v, Node<T>* n, unsigned int copies)
 		{
 			if (n == nullptr)
 			{
-				return new Node<T>(v);
+				size++;
+				Node<T>* added = new Node<T>(v);
+				added->count = copies;
+				return added;
 			}
 
 			if (v < n->key)
-				n->left = Insert(v, n->left);
+				n->left = Insert(v, n->left, copies);
 			else if (v > n->key)
-				n->right = Insert(v, n->right);
+				n->right = Insert(v, n->right, copies);
+			else
+			{
+				if (multiset)
+					TreeUtils::AddCopies(n, copies);
+				return n; // Shape unchanged
+			}
 
 			return Balance(n);
 		}
@@ -149,16 +295,95 @@ namespace myDataStructures
 		template<typename T>
 		Node<T>* AVLTree<T>::FindMax(Node<T>* n)
 		{
-			return n->Right ? FindMax(n->right) : n;
+			return n->right ? FindMax(n->right) : n;
+		}
+
+		template<typename T>
+		// unlinks the leftmost node under n, parent is n's parent
+		Node<T>* AVLTree<T>::RemoveMin(Node<T>* n, Node<T>* parent)
+		{
+			if (n->left != nullptr)
+			{
+				n->left = RemoveMin(n->left, n);
+				return Balance(n);
+			}
+
+			// A right child of the minimum is a leaf, so it or the parent comes next. Rotations on the way up keep both nodes.
+			Node<T>* right = n->right;
+			leftmost = right != nullptr ? right : parent;
+			if (rightmost == n)
+				rightmost = nullptr; // n was the only node
+
+			delete n;
+			size--;
+			return right;
+		}
+
+		template<typename T>
+		// unlinks the rightmost node under n, parent is n's parent
+		Node<T>* AVLTree<T>::RemoveMax(Node<T>* n, Node<T>* parent)
+		{
+			if (n->right != nullptr)
+			{
+				n->right = RemoveMax(n->right, n);
+				return Balance(n);
+			}
+
+			Node<T>* left = n->left;
+			rightmost = left != nullptr ? left : parent;
+			if (leftmost == n)
+				leftmost = nullptr;
+
+			delete n;
+			size--;
+			return left;
+		}
+
+		template<typename T>
+		// walks down again to whichever extreme a change dropped
+		void AVLTree<T>::RestoreExtremes()
+		{
+			if (root == nullptr)
+			{
+				leftmost = rightmost = nullptr;
+				return;
+			}
+
+			if (leftmost == nullptr)
+				leftmost = FindMin(root);
+			if (rightmost == nullptr)
+				rightmost = FindMax(root);
+		}
+
+		template<typename T>
+		// the insert behind Insert and InsertBatch, adding copies of v in one descent
+		void AVLTree<T>::InsertKey(T v, unsigned int copies)
+		{
+			if (relaxed)
+			{
+				RelaxedInsert(v, copies);
+				return;
+			}
+
+			root = Insert(v, root, copies);
+
+			// Rotations never move a key to another node, so only a new extreme needs looking up
+			if (leftmost == nullptr || v < leftmost->key)
+				leftmost = FindMin(root);
+			if (rightmost == nullptr || rightmost->key < v)
+				rightmost = FindMax(root);
 		}
 
 		template<typename T>
-		void* AVLTree<T>::PopMax(Node<T>* n)
+		// the removal behind Remove, EraseOne, EraseAll and the relaxed pops
+		void AVLTree<T>::RemoveKey(T v)
 		{
-			Node<T>* max = FindMax(n);
-			void* key = max->key;
-			Remove(n, key);
-			return key;
+			if (relaxed)
+				RelaxedRemove(v);
+			else
+				root = Remove(v, root);
+
+			RestoreExtremes();
 		}
 
 		template<typename T>
@@ -182,6 +407,7 @@ namespace myDataStructures
 			{
 				temp = FindMin(n->right);
 				n->key = temp->key;
+				n->count = temp->count;
 				n->right = Remove(n->key, n->right);
 			}
 			// With one or zero child
@@ -193,7 +419,13 @@ namespace myDataStructures
 				else if (n->right == nullptr)
 					n = n->left;
 
+				if (temp == leftmost)
+					leftmost = nullptr;
+				if (temp == rightmost)
+					rightmost = nullptr;
+
 				delete temp;
+				size--;
 			}
 
 			if (n == nullptr)
@@ -203,26 +435,470 @@ namespace myDataStructures
 		}
 
 		template<typename T>
+		// frees a subtree the tree no longer links to, without recursion or on the reclaimer
 		void AVLTree<T>::Clear(Node<T>* n)
 		{
+			if (backgroundFree)
+				NodeReclaimer::Reclaimer::Instance().Reclaim(n);
+			else
+				TreeUtils::FreeSubtree(n);
+		}
+
+		template<typename T>
+		// links the sorted nodes[lo, hi) into a perfectly balanced subtree
+		Node<T>* AVLTree<T>::BuildBalanced(std::vector<Node<T>*>& nodes, size_t lo, size_t hi)
+		{
+			if (lo >= hi)
+				return nullptr;
+
+			size_t mid = lo + (hi - lo) / 2;
+			Node<T>* n = nodes[mid];
+			n->left = BuildBalanced(nodes, lo, mid);
+			n->right = BuildBalanced(nodes, mid + 1, hi);
+			n->dirty = 0;
+			FixHeight(n);
+			return n;
+		}
+
+		template<typename T>
+		// same as BuildBalanced, with the two halves of the top splits levels linked on separate threads
+		Node<T>* AVLTree<T>::BuildBalancedParallel(std::vector<Node<T>*>& nodes, size_t lo, size_t hi, unsigned splits)
+		{
+			if (splits == 0 || hi - lo < 4096)
+				return BuildBalanced(nodes, lo, hi);
+
+			size_t mid = lo + (hi - lo) / 2;
+			Node<T>* n = nodes[mid];
+			Parallel::Invoke(true,
+				[&]() { n->left = BuildBalancedParallel(nodes, lo, mid, splits - 1); },
+				[&]() { n->right = BuildBalancedParallel(nodes, mid + 1, hi, splits - 1); });
+			n->dirty = 0;
+			FixHeight(n);
+			return n;
+		}
+
+		template<typename T>
+		// plain BST insert that marks the search path, the new node's ancestors. Keys past the extreme
+		// the previous insert added skip the descent.
+		void AVLTree<T>::RelaxedInsert(T v, unsigned int copies)
+		{
+			if (AppendToRun(v, copies))
+				return;
+
+			Node<T>** link = &root;
+			size_t depth = 0;
+			while (*link != nullptr)
+			{
+				Node<T>* n = *link;
+				bool right = n->key < v;
+				if (!right && !(v < n->key))
+				{
+					if (multiset)
+						TreeUtils::AddCopies(n, copies);
+					return;
+				}
+
+				link = right ? &n->right : &n->left;
+				n->dirty = 1;
+				depth++;
+			}
+
+			Node<T>* added = new Node<T>(v);
+			added->count = copies;
+			added->dirty = 1;
+			*link = added;
+			size++;
+			relaxedPeak = std::max(relaxedPeak, size);
+
+			if (leftmost == nullptr || v < leftmost->key)
+				leftmost = added;
+			if (rightmost == nullptr || rightmost->key < v)
+				rightmost = added;
+
+			// A valid AVL tree is never deeper than 1.44 log2(n), so this only triggers on real skew
+			size_t maxDepth = 2;
+			for (size_t s = size; s > 1; s >>= 1)
+				maxDepth += 2;
+
+			runSpine.clear();
+			if (depth > maxDepth)
+			{
+				pathBuffer.clear();
+				for (Node<T>* n = root; n != added; n = v < n->key ? n->left : n->right)
+					pathBuffer.push_back(n);
+
+				RebuildScapegoat(added);
+				return;
+			}
+
+			// The new node may start a run. Its ancestors are marked, and the spine nodes stay marked.
+			runSpine.push_back(added);
+			runLink = link;
+			runDepth = depth;
+		}
+
+		template<typename T>
+		// adds v below the extreme the previous relaxed insert added when v lies past it. The new node joins the
+		// spine, and while the two lowest spine nodes have inner subtrees of the same height, the upper one and
+		// its inner subtree become the lower one's inner subtree: three links and a height per carry, O(1)
+		// amortized per key. The run stays within log2(run size) + 1 levels below its top, and a run reaching
+		// deeper than the depth limit is cut back like any other deep insert.
+		bool AVLTree<T>::AppendToRun(T v, unsigned int copies)
+		{
+			if (runSpine.empty())
+				return false;
+
+			Node<T>* last = runSpine.back();
+			bool right;
+			if (last == rightmost && last->key < v)
+				right = true;
+			else if (last == leftmost && v < last->key)
+				right = false;
+			else
+				return false;
+
+			if (runSpine.size() > 1 && right != runRight)
+				return false;
+
+			runRight = right;
+			Node<T>* Node<T>::* outer = right ? &Node<T>::right : &Node<T>::left;
+			Node<T>* Node<T>::* inner = right ? &Node<T>::left : &Node<T>::right;
+
+			Node<T>* added = new Node<T>(v);
+			added->count = copies;
+			added->dirty = 1;
+			last->*outer = added;
+			runSpine.push_back(added);
+			size++;
+			relaxedPeak = std::max(relaxedPeak, size);
+			if (right)
+				rightmost = added;
+			else
+				leftmost = added;
+
+			while (runSpine.size() > 1 && runSpine[runSpine.size() - 2]->height == added->height)
+			{
+				Node<T>* carried = runSpine[runSpine.size() - 2];
+				carried->*outer = added->*inner;
+				carried->dirty = 0;
+				FixHeight(carried); // Both subtrees are perfect trees of the same height now
+				added->*inner = carried;
+				added->height++;
+				runSpine.pop_back();
+				runSpine.back() = added;
+				if (runSpine.size() == 1)
+					*runLink = added;
+				else
+					runSpine[runSpine.size() - 2]->*outer = added;
+			}
+
+			size_t maxDepth = 2;
+			for (size_t s = size; s > 1; s >>= 1)
+				maxDepth += 2;
+
+			// The deepest nodes are at the bottom of the top spine node's inner subtree. The run itself is balanced,
+			// so a run too deep is rebuilt with the ancestors that make it too deep.
+			if (runDepth + runSpine[0]->height - 1 > maxDepth)
+			{
+				Node<T>* top = runSpine[0];
+				runSpine.clear();
+				pathBuffer.clear();
+				for (Node<T>* n = root; n != top; n = top->key < n->key ? n->left : n->right)
+					pathBuffer.push_back(n);
+
+				RebuildScapegoat(top);
+			}
+
+			return true;
+		}
+
+		template<typename T>
+		// plain BST remove that only marks the search path
+		void AVLTree<T>::RelaxedRemove(T v)
+		{
+			Node<T>** link = &root;
+			while (*link != nullptr && (v < (*link)->key || (*link)->key < v))
+			{
+				(*link)->dirty = 1;
+				link = v < (*link)->key ? &(*link)->left : &(*link)->right;
+			}
+
+			Node<T>* n = *link;
 			if (n == nullptr)
 				return;
 
-			Clear(n->left);
-			Clear(n->right);
+			if (n->left != nullptr && n->right != nullptr)
+			{
+				// Take over the successor's key and unlink the successor instead
+				n->dirty = 1;
+				Node<T>** successorLink = &n->right;
+				while ((*successorLink)->left != nullptr)
+				{
+					(*successorLink)->dirty = 1;
+					successorLink = &(*successorLink)->left;
+				}
+
+				Node<T>* successor = *successorLink;
+				n->key = successor->key;
+				n->count = successor->count;
+				*successorLink = successor->right;
+				n = successor;
+			}
+			else
+				*link = n->left != nullptr ? n->left : n->right;
+
+			if (n == leftmost)
+				leftmost = nullptr;
+			if (n == rightmost)
+				rightmost = nullptr;
+			runSpine.clear(); // The run's shape is only known while nothing else changes it
+
 			delete n;
+			size--;
+
+			// Removes never deepen the tree, but the depth allowed shrinks with the size. Rebuilding once half
+			// the nodes are gone keeps the depth within the limit of twice the size, O(1) amortized per remove.
+			if (2 * size < relaxedPeak)
+			{
+				rebuildBuffer.clear();
+				GatherSubtree(root, rebuildBuffer);
+				root = BuildBalanced(rebuildBuffer, 0, rebuildBuffer.size());
+				relaxedPeak = size;
+			}
 		}
 
 		template<typename T>
-		void AVLTree<T>::InOrder(Node<T>* n)
+		// rebuilds the lowest ancestor of top whose child on the path holds more than 2/3 of its nodes, as in a
+		// scapegoat tree, or the whole tree when there is none. pathBuffer holds the ancestors of top. The nodes
+		// are gathered while climbing, the smaller ones into rebuildBuffer from the nearest down and the larger
+		// ones, starting with top's subtree, into upperBuffer, so every node is visited once whichever ancestor is rebuilt.
+		void AVLTree<T>::RebuildScapegoat(Node<T>* top)
 		{
-			if (!n)
-				return;
+			rebuildBuffer.clear();
+			upperBuffer.clear();
+			GatherSubtree(top, upperBuffer);
+			Node<T>* child = top;
+			size_t i = pathBuffer.size();
+			while (i > 0)
+			{
+				Node<T>* n = pathBuffer[--i];
+				size_t childSize = rebuildBuffer.size() + upperBuffer.size();
+				if (n->right == child)
+				{
+					rebuildBuffer.push_back(n);
+					size_t first = rebuildBuffer.size();
+					GatherSubtree(n->left, rebuildBuffer);
+					std::reverse(rebuildBuffer.begin() + first, rebuildBuffer.end());
+				}
+				else
+				{
+					upperBuffer.push_back(n);
+					GatherSubtree(n->right, upperBuffer);
+				}
+
+				size_t nodeSize = rebuildBuffer.size() + upperBuffer.size();
+				if (3 * childSize > 2 * nodeSize || i == 0)
+				{
+					std::reverse(rebuildBuffer.begin(), rebuildBuffer.end());
+					rebuildBuffer.insert(rebuildBuffer.end(), upperBuffer.begin(), upperBuffer.end());
+
+					Node<T>* rebuilt = BuildBalanced(rebuildBuffer, 0, rebuildBuffer.size());
+					if (i == 0)
+						root = rebuilt;
+					else if (pathBuffer[i - 1]->left == n)
+						pathBuffer[i - 1]->left = rebuilt;
+					else
+						pathBuffer[i - 1]->right = rebuilt;
+					return;
+				}
+
+				child = n;
+			}
+		}
+
+		template<typename T>
+		void AVLTree<T>::GatherSubtree(Node<T>* n, std::vector<Node<T>*>& nodes)
+		{
+			auto gather = [&nodes](Node<T>* node) { nodes.push_back(node); };
+			TreeUtils::ForEachNodeInSubtree(n, gather);
+		}
+
+		template<typename T>
+		// repairs the marked nodes bottom up, joining each one's repaired subtrees back together
+		Node<T>* AVLTree<T>::RebalanceDirty(Node<T>* n)
+		{
+			if (n == nullptr || !n->dirty)
+				return n; // Nothing below changed, so the heights are exact
+
+			// The right child is needed once the left subtree is done, by then the prefetch has landed
+			MYDS_PREFETCH(n->right);
+			Node<T>* left = RebalanceDirty(n->left);
+			Node<T>* right = RebalanceDirty(n->right);
+			n->dirty = 0;
+			return Join(left, n, right);
+		}
+
+		template<typename T>
+		// links two valid AVL trees under pivot, all of left being smaller than pivot and all of right larger.
+		// The pivot goes down the taller tree's inner spine to where the heights match, and each frame on the
+		// way back is at most 2 out of balance, which Balance fixes. Costs O(1 + the height difference).
+		Node<T>* AVLTree<T>::Join(Node<T>* left, Node<T>* pivot, Node<T>* right)
+		{
+			if (Height(left) > Height(right) + 1)
+			{
+				left->right = Join(left->right, pivot, right);
+				return Balance(left);
+			}
+
+			if (Height(right) > Height(left) + 1)
+			{
+				right->left = Join(left, pivot, right->left);
+				return Balance(right);
+			}
+
+			pivot->left = left;
+			pivot->right = right;
+			FixHeight(pivot);
+			return pivot;
+		}
+
+		template<typename T>
+		// copies the subtree under n, heights and counts included
+		Node<T>* AVLTree<T>::CloneSubtree(const Node<T>* n) const
+		{
+			if (n == nullptr)
+				return nullptr;
+
+			Node<T>* copy = new Node<T>(n->key);
+			copy->height = n->height;
+			copy->dirty = n->dirty;
+			copy->count = n->count;
+			copy->left = CloneSubtree(n->left);
+			copy->right = CloneSubtree(n->right);
+			return copy;
+		}
+
+		template<typename T>
+		// same as CloneSubtree, with the two children of the top splits levels cloned on separate threads
+		Node<T>* AVLTree<T>::CloneSubtreeParallel(const Node<T>* n, unsigned splits) const
+		{
+			if (splits == 0 || n == nullptr || n->height < 12)
+				return CloneSubtree(n);
+
+			Node<T>* copy = new Node<T>(n->key);
+			copy->height = n->height;
+			copy->dirty = n->dirty;
+			copy->count = n->count;
+			Parallel::Invoke(true,
+				[&]() { copy->left = CloneSubtreeParallel(n->left, splits - 1); },
+				[&]() { copy->right = CloneSubtreeParallel(n->right, splits - 1); });
+			return copy;
+		}
+
+		template<typename T>
+		template<typename F>
+		void AVLTree<T>::ForEachNodeInOrder(F&& f)
+		{
+			Node<T>* current = root;
+			size_t threads = 0; // Removed by the guard after an early exit or a throw
+			TreeUtils::MorrisGuard<Node<T>> guard{ current, threads };
+
+			while (current != nullptr)
+			{
+				if (current->left == nullptr)
+				{
+					Node<T>* visited = current;
+					current = current->right;
+					if (!TreeUtils::Visit(f, visited))
+						return;
+				}
+				else
+				{
+					Node<T>* predecessor = current->left;
+					while (predecessor->right != nullptr && predecessor->right != current)
+						predecessor = predecessor->right;
+
+					if (predecessor->right == nullptr)
+					{
+						// Thread the predecessor back to current and go left
+						predecessor->right = current;
+						current = current->left;
+						threads++;
+						continue;
+					}
+
+					// Left subtree is done, remove the thread
+					predecessor->right = nullptr;
+					threads--;
+					Node<T>* visited = current;
+					current = current->right;
+					if (!TreeUtils::Visit(f, visited))
+						return;
+				}
+			}
+		}
+
+		template<typename T>
+		template<typename F>
+		void AVLTree<T>::ForEachNodePreOrder(F&& f)
+		{
+			Node<T>* current = root;
+			size_t threads = 0;
+			TreeUtils::MorrisGuard<Node<T>> guard{ current, threads };
+
+			while (current != nullptr)
+			{
+				if (current->left == nullptr)
+				{
+					Node<T>* visited = current;
+					current = current->right;
+					if (!TreeUtils::Visit(f, visited))
+						return;
+				}
+				else
+				{
+					Node<T>* predecessor = current->left;
+					while (predecessor->right != nullptr && predecessor->right != current)
+						predecessor = predecessor->right;
+
+					if (predecessor->right == nullptr)
+					{
+						// Visited before threading, so a throw leaves no new thread behind
+						if (!TreeUtils::Visit(f, current))
+							return;
+
+						predecessor->right = current;
+						current = current->left;
+						threads++;
+						continue;
+					}
+
+					predecessor->right = nullptr;
+					threads--;
+					current = current->right;
+				}
+			}
+		}
+
+		template<typename T>
+		template<typename F>
+		void AVLTree<T>::ForEachNodeLevelOrder(F&& f)
+		{
+			levelBuffer.clear();
+			if (root != nullptr)
+				levelBuffer.push_back(root);
 
-			InOrder(n->left);
-			std::cout << n->key << " ";
-			InOrder(n->right);
+			for (size_t i = 0; i < levelBuffer.size(); i++)
+			{
+				Node<T>* n = levelBuffer[i];
+				if (!TreeUtils::Visit(f, n))
+					return;
 
+				if (n->left != nullptr)
+					levelBuffer.push_back(n->left);
+				if (n->right != nullptr)
+					levelBuffer.push_back(n->right);
+			}
 		}
 
 		////////////////////////
@@ -230,9 +906,103 @@ namespace myDataStructures
 		////////////////////////
 
 		template<typename T>
-		AVLTree<T>::AVLTree()
+		AVLTree<T>::AVLTree(bool multiset)
 		{
 			root = nullptr;
+			leftmost = rightmost = nullptr;
+			size = 0;
+			this->multiset = multiset;
+			relaxed = false;
+			backgroundFree = false;
+			runLink = nullptr;
+			runDepth = 0;
+			runRight = false;
+			relaxedPeak = 0;
+		}
+
+		template<typename T>
+		AVLTree<T>::AVLTree(const AVLTree& other)
+		{
+			root = CloneSubtree(other.root);
+			leftmost = rightmost = nullptr;
+			size = other.size;
+			multiset = other.multiset;
+			relaxed = other.relaxed;
+			backgroundFree = other.backgroundFree;
+			runLink = nullptr;
+			runDepth = 0;
+			runRight = false;
+			relaxedPeak = other.relaxedPeak;
+			RestoreExtremes();
+		}
+
+		template<typename T>
+		AVLTree<T>::AVLTree(AVLTree&& other) noexcept
+			: levelBuffer(std::move(other.levelBuffer))
+		{
+			root = other.root;
+			leftmost = other.leftmost;
+			rightmost = other.rightmost;
+			size = other.size;
+			multiset = other.multiset;
+			relaxed = other.relaxed;
+			backgroundFree = other.backgroundFree;
+			runLink = nullptr;
+			runDepth = 0;
+			runRight = false;
+			relaxedPeak = other.relaxedPeak;
+			other.root = nullptr;
+			other.leftmost = other.rightmost = nullptr;
+			other.runSpine.clear();
+			other.size = 0;
+			other.relaxedPeak = 0;
+		}
+
+		template<typename T>
+		AVLTree<T>& AVLTree<T>::operator=(const AVLTree& other)
+		{
+			if (this != &other)
+			{
+				Node<T>* copy = CloneSubtree(other.root);
+				Clear(root);
+				root = copy;
+				leftmost = rightmost = nullptr;
+				size = other.size;
+				multiset = other.multiset;
+				relaxed = other.relaxed;
+				backgroundFree = other.backgroundFree;
+				runSpine.clear();
+				relaxedPeak = other.relaxedPeak;
+				RestoreExtremes();
+			}
+
+			return *this;
+		}
+
+		template<typename T>
+		AVLTree<T>& AVLTree<T>::operator=(AVLTree&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Clear(root);
+				root = other.root;
+				leftmost = other.leftmost;
+				rightmost = other.rightmost;
+				size = other.size;
+				multiset = other.multiset;
+				relaxed = other.relaxed;
+				backgroundFree = other.backgroundFree;
+				levelBuffer = std::move(other.levelBuffer);
+				runSpine.clear();
+				relaxedPeak = other.relaxedPeak;
+				other.runSpine.clear();
+				other.root = nullptr;
+				other.leftmost = other.rightmost = nullptr;
+				other.size = 0;
+				other.relaxedPeak = 0;
+			}
+
+			return *this;
 		}
 
 		template<typename T>
@@ -241,24 +1011,346 @@ namespace myDataStructures
 			Clear(root);
 		}
 
+		template<typename T>
+		AVLTree<T> AVLTree<T>::CloneParallel(unsigned threads) const
+		{
+			AVLTree<T> copy(multiset);
+			copy.relaxed = relaxed;
+			copy.backgroundFree = backgroundFree;
+			copy.root = CloneSubtreeParallel(root, Parallel::SplitDepth(Parallel::ThreadCount(threads)));
+			copy.size = size;
+			copy.relaxedPeak = relaxedPeak;
+			copy.RestoreExtremes();
+			return copy;
+		}
+
+		template<typename T>
+		void AVLTree<T>::SetBackgroundFree(bool backgroundFree)
+		{
+			this->backgroundFree = backgroundFree;
+		}
+
+		template<typename T>
+		void AVLTree<T>::Clear()
+		{
+			Clear(root);
+			root = nullptr;
+			leftmost = rightmost = nullptr;
+			size = 0;
+			runSpine.clear();
+			relaxedPeak = 0;
+		}
+
 		template<typename T>
 		void AVLTree<T>::Insert(T v)
 		{
-			root = Insert(v, root);
+			MYDS_TRACE(AVLTree, Insert, v);
+			InsertKey(v, 1);
 		}
 
 		template<typename T>
 		void AVLTree<T>::Remove(T v)
 		{
-			root = Remove(v, root);
+			MYDS_TRACE(AVLTree, Delete, v);
+			RemoveKey(v);
+		}
+
+		template<typename T>
+		void AVLTree<T>::SetRelaxed(bool relaxed)
+		{
+			if (this->relaxed && !relaxed)
+				Rebalance();
+			else if (!this->relaxed && relaxed)
+				relaxedPeak = size;
+
+			this->relaxed = relaxed;
+		}
+
+		template<typename T>
+		void AVLTree<T>::Rebalance()
+		{
+			runSpine.clear();
+			root = RebalanceDirty(root);
+			relaxedPeak = size;
+		}
+
+		template<typename T>
+		Node<T>* AVLTree<T>::Min() const
+		{
+			return leftmost;
+		}
+
+		template<typename T>
+		Node<T>* AVLTree<T>::Max() const
+		{
+			return rightmost;
+		}
+
+		template<typename T>
+		bool AVLTree<T>::PopMin(T& key)
+		{
+			if (leftmost == nullptr)
+				return false;
+
+			key = leftmost->key;
+			if (leftmost->count > 1)
+			{
+				MYDS_TRACE(AVLTree, EraseOne, key);
+				leftmost->count--;
+				return true;
+			}
+
+			MYDS_TRACE(AVLTree, Delete, key);
+			if (relaxed)
+				RemoveKey(key); // Heights may be stale, so RemoveMin could not balance
+			else
+				root = RemoveMin(root, nullptr);
+
+			return true;
+		}
+
+		template<typename T>
+		bool AVLTree<T>::PopMax(T& key)
+		{
+			if (rightmost == nullptr)
+				return false;
+
+			key = rightmost->key;
+			if (rightmost->count > 1)
+			{
+				MYDS_TRACE(AVLTree, EraseOne, key);
+				rightmost->count--;
+				return true;
+			}
+
+			MYDS_TRACE(AVLTree, Delete, key);
+			if (relaxed)
+				RemoveKey(key);
+			else
+				root = RemoveMax(root, nullptr);
+
+			return true;
+		}
+
+		template<typename T>
+		size_t AVLTree<T>::Size() const
+		{
+			return size;
+		}
+
+		template<typename T>
+		Node<T>* AVLTree<T>::Search(T v)
+		{
+			MYDS_TRACE(AVLTree, Search, v);
+			return Locate(v);
+		}
+
+		template<typename T>
+		Node<T>* AVLTree<T>::Locate(T v)
+		{
+			Node<T>* n = root;
+			while (n != nullptr)
+			{
+				if (v < n->key)
+					n = n->left;
+				else if (n->key < v)
+					n = n->right;
+				else
+					break;
+			}
+
+			return n;
+		}
+
+		template<typename T>
+		void AVLTree<T>::SearchBatch(const std::vector<T>& keys, std::vector<Node<T>*>& results)
+		{
+			TreeUtils::InterleavedSearch(root, keys, results, [](Node<T>* n) -> const T& { return n->key; });
+		}
+
+		template<typename T>
+		unsigned int AVLTree<T>::Count(T v)
+		{
+			Node<T>* n = Locate(v);
+			return n != nullptr ? n->count : 0;
+		}
+
+		template<typename T>
+		bool AVLTree<T>::EraseOne(T v)
+		{
+			Node<T>* n = Locate(v);
+			if (n != nullptr && n->count > 1)
+			{
+				MYDS_TRACE(AVLTree, EraseOne, v);
+				n->count--;
+				return true;
+			}
+
+			MYDS_TRACE(AVLTree, Delete, v);
+			if (n == nullptr)
+				return false;
+
+			RemoveKey(v);
+			return true;
+		}
+
+		template<typename T>
+		unsigned int AVLTree<T>::EraseAll(T v)
+		{
+			MYDS_TRACE(AVLTree, Delete, v);
+			Node<T>* n = Locate(v);
+			if (n == nullptr)
+				return 0;
+
+			unsigned int count = n->count;
+			RemoveKey(v);
+			return count;
+		}
+
+		template<typename T>
+		template<typename It>
+		void AVLTree<T>::InsertBatch(It first, It last)
+		{
+			std::vector<T> batch(first, last);
+			MYDS_TRACE_EACH(AVLTree, Insert, batch.begin(), batch.end());
+			std::vector<unsigned> counts;
+			std::vector<unsigned>* batchCounts = multiset ? &counts : nullptr;
+			TreeUtils::PrepareBatch(batch, batchCounts, 1);
+			if (batch.empty())
+				return;
+
+			if (TreeUtils::DescentsCheaper(batch.size(), size))
+			{
+				for (size_t i = 0; i < batch.size(); i++)
+					InsertKey(batch[i], multiset ? counts[i] : 1);
+				return;
+			}
+
+			std::vector<Node<T>*> nodes;
+			nodes.reserve(size + batch.size());
+			TreeUtils::MergeBatch(root, batch, batchCounts, [](Node<T>* n) -> const T& { return n->key; }, nodes);
+
+			size = nodes.size();
+			runSpine.clear();
+			relaxedPeak = size;
+			root = BuildBalanced(nodes, 0, nodes.size());
+			leftmost = nodes.front();
+			rightmost = nodes.back();
+		}
+
+		template<typename T>
+		template<typename It>
+		void AVLTree<T>::BuildParallel(It first, It last, unsigned threads)
+		{
+			threads = Parallel::ThreadCount(threads);
+			std::vector<T> batch(first, last);
+			MYDS_TRACE_EACH(AVLTree, Insert, batch.begin(), batch.end());
+			std::vector<unsigned> counts;
+			std::vector<unsigned>* batchCounts = multiset ? &counts : nullptr;
+			TreeUtils::PrepareBatch(batch, batchCounts, threads);
+
+			std::vector<Node<T>*> nodes;
+			TreeUtils::MergeBatchParallel(root, size, batch, batchCounts, threads, [](Node<T>* n) -> const T& { return n->key; }, nodes);
+
+			size = nodes.size();
+			runSpine.clear();
+			relaxedPeak = size;
+			root = BuildBalancedParallel(nodes, 0, nodes.size(), Parallel::SplitDepth(threads));
+			leftmost = rightmost = nullptr;
+			RestoreExtremes();
 		}
 
 		template<typename T>
 		void AVLTree<T>::Display()
 		{
-			InOrder(root);
+			ForEachInOrder([](const T& key) { std::cout << key << " "; });
 			std::cout << std::endl;
 		}
+
+		template<typename T>
+		// cuts the tree into about eight chunks per thread, in key order
+		void AVLTree<T>::CollectChunks(std::vector<TreeUtils::SubtreeChunk<Node<T>>>& chunks, unsigned threads)
+		{
+			unsigned depth = Parallel::SplitDepth(Parallel::ThreadCount(threads) * 8);
+			if (size < 4096 || Parallel::ThreadCount(threads) == 1)
+				depth = 0;
+
+			unsigned char cutoff = Height(root) > depth ? static_cast<unsigned char>(Height(root) - depth) : 0;
+			CollectChunks(root, cutoff, chunks);
+		}
+
+		template<typename T>
+		// subtrees no higher than cutoff become one chunk, the nodes above them a chunk each
+		void AVLTree<T>::CollectChunks(Node<T>* n, unsigned char cutoff, std::vector<TreeUtils::SubtreeChunk<Node<T>>>& chunks)
+		{
+			if (n == nullptr)
+				return;
+
+			if (n->height <= cutoff)
+			{
+				chunks.push_back({ n, true });
+				return;
+			}
+
+			CollectChunks(n->left, cutoff, chunks);
+			chunks.push_back({ n, false });
+			CollectChunks(n->right, cutoff, chunks);
+		}
+
+		template<typename T>
+		template<typename F>
+		void AVLTree<T>::ParallelForEach(F&& f, unsigned threads)
+		{
+			std::vector<TreeUtils::SubtreeChunk<Node<T>>> chunks;
+			CollectChunks(chunks, threads);
+			TreeUtils::ParallelForEachChunk(chunks, threads, f, [](Node<T>* n) -> const T& { return n->key; });
+		}
+
+		template<typename T>
+		template<typename R, typename Op>
+		R AVLTree<T>::ParallelReduce(R identity, Op op, unsigned threads)
+		{
+			std::vector<TreeUtils::SubtreeChunk<Node<T>>> chunks;
+			CollectChunks(chunks, threads);
+			return TreeUtils::ParallelReduceChunks(chunks, threads, identity, op, [](Node<T>* n) -> const T& { return n->key; }, false);
+		}
+
+		template<typename T>
+		template<typename R, typename Op>
+		R AVLTree<T>::ParallelReduceOrdered(R identity, Op op, unsigned threads)
+		{
+			std::vector<TreeUtils::SubtreeChunk<Node<T>>> chunks;
+			CollectChunks(chunks, threads);
+			return TreeUtils::ParallelReduceChunks(chunks, threads, identity, op, [](Node<T>* n) -> const T& { return n->key; }, true);
+		}
+
+		template<typename T>
+		template<typename F>
+		void AVLTree<T>::ForEachWithCount(F&& f)
+		{
+			ForEachNodeInOrder([&f](Node<T>* n) { return TreeUtils::Visit(f, static_cast<const T&>(n->key), n->count); });
+		}
+
+		template<typename T>
+		template<typename F>
+		void AVLTree<T>::ForEachInOrder(F&& f)
+		{
+			ForEachNodeInOrder([&f](Node<T>* n) { return TreeUtils::Visit(f, static_cast<const T&>(n->key)); });
+		}
+
+		template<typename T>
+		template<typename F>
+		void AVLTree<T>::ForEachPreOrder(F&& f)
+		{
+			ForEachNodePreOrder([&f](Node<T>* n) { return TreeUtils::Visit(f, static_cast<const T&>(n->key)); });
+		}
+
+		template<typename T>
+		template<typename F>
+		void AVLTree<T>::ForEachLevelOrder(F&& f)
+		{
+			ForEachNodeLevelOrder([&f](Node<T>* n) { return TreeUtils::Visit(f, static_cast<const T&>(n->key)); });
+		}
 	}
 }
 
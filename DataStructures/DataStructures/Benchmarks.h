@@ -0,0 +1,508 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+#include "AVLTree.h"
+#include "RBTree.h"
+#include "CompactRBTree.h"
+#include "IntervalTree.h"
+#include "LockFreeSkipList.h"
+#include "StaticSet.h"
+
+namespace myDataStructures
+{
+	namespace Benchmarks
+	{
+		typedef std::chrono::steady_clock Clock;
+
+		inline double ElapsedMs(Clock::time_point start)
+		{
+			return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		}
+
+		inline std::vector<int> RandomKeys(size_t count, unsigned seed)
+		{
+			std::mt19937 generator(seed);
+			std::vector<int> keys(count);
+			for (size_t i = 0; i < count; i++)
+				keys[i] = static_cast<int>(generator() >> 1);
+
+			return keys;
+		}
+
+		// Footprint and lookup latency of RBTree against the arena indexed CompactRBTree
+		inline void CompactLayout(size_t count)
+		{
+			std::vector<int> keys = RandomKeys(count, 42);
+			std::vector<int> probes = RandomKeys(count, 7);
+			for (size_t i = 0; i < probes.size(); i += 2)
+				probes[i] = keys[i]; // Half hits, half misses
+
+			RBTree::RBTree<int> pointerTree;
+			CompactRBTree::CompactRBTree<int> compactTree;
+			compactTree.Reserve(count);
+			for (int key : keys)
+			{
+				pointerTree.InsertValue(key);
+				compactTree.InsertValue(key);
+			}
+
+			size_t hits = 0;
+			Clock::time_point start = Clock::now();
+			for (int probe : probes)
+				hits += pointerTree.Search(probe)->data == probe;
+			double pointerMs = ElapsedMs(start);
+
+			start = Clock::now();
+			for (int probe : probes)
+				hits += compactTree.Contains(probe);
+			double compactMs = ElapsedMs(start);
+
+			// Each heap node also pays the allocator header, which the arena does not
+			std::cout << "Compact layout, " << compactTree.Size() << " keys (" << hits << " hits)" << std::endl;
+			std::cout << "  RBTree:        " << sizeof(RBTree::Node<int>) << " bytes/node, "
+				<< sizeof(RBTree::Node<int>) * compactTree.Size() / 1024 << " KiB + allocator overhead, "
+				<< pointerMs * 1e6 / probes.size() << " ns/lookup" << std::endl;
+			std::cout << "  CompactRBTree: " << sizeof(CompactRBTree::Node<int>) << " bytes/node, "
+				<< compactTree.MemoryUsage() / 1024 << " KiB, "
+				<< compactMs * 1e6 / probes.size() << " ns/lookup" << std::endl;
+		}
+
+		// One lookup at a time against SearchBatch, on trees meant to be larger than the last level cache
+		inline void BatchedSearch(size_t count, size_t lookups, size_t batchSize)
+		{
+			std::vector<int> keys = RandomKeys(count, 42);
+			std::vector<int> probes = RandomKeys(lookups, 7);
+			for (size_t i = 0; i < probes.size(); i += 2)
+				probes[i] = keys[(i * 7919) % keys.size()]; // Half hits, half misses
+
+			RBTree::RBTree<int> rbTree;
+			AVLTree::AVLTree<int> avlTree;
+			rbTree.BuildParallel(keys.begin(), keys.end());
+			avlTree.BuildParallel(keys.begin(), keys.end());
+
+			std::cout << "Batched search, " << rbTree.Size() << " keys, " << lookups << " lookups in batches of " << batchSize << std::endl;
+
+			size_t hits = 0;
+			Clock::time_point start = Clock::now();
+			for (int probe : probes)
+				hits += rbTree.Search(probe)->data == probe;
+			double singleMs = ElapsedMs(start);
+
+			std::vector<int> batch;
+			std::vector<RBTree::Node<int>*> rbResults;
+			start = Clock::now();
+			for (size_t i = 0; i < probes.size(); i += batchSize)
+			{
+				batch.assign(probes.begin() + i, probes.begin() + std::min(probes.size(), i + batchSize));
+				rbTree.SearchBatch(batch, rbResults);
+				for (RBTree::Node<int>* n : rbResults)
+					hits += n != nullptr;
+			}
+			double batchMs = ElapsedMs(start);
+			std::cout << "  RBTree:  Search " << singleMs * 1e6 / lookups << " ns/lookup, SearchBatch "
+				<< batchMs * 1e6 / lookups << " ns/lookup (" << singleMs / batchMs << "x)" << std::endl;
+
+			start = Clock::now();
+			for (int probe : probes)
+				hits += avlTree.Search(probe) != nullptr;
+			singleMs = ElapsedMs(start);
+
+			std::vector<AVLTree::Node<int>*> avlResults;
+			start = Clock::now();
+			for (size_t i = 0; i < probes.size(); i += batchSize)
+			{
+				batch.assign(probes.begin() + i, probes.begin() + std::min(probes.size(), i + batchSize));
+				avlTree.SearchBatch(batch, avlResults);
+				for (AVLTree::Node<int>* n : avlResults)
+					hits += n != nullptr;
+			}
+			batchMs = ElapsedMs(start);
+			std::cout << "  AVLTree: Search " << singleMs * 1e6 / lookups << " ns/lookup, SearchBatch "
+				<< batchMs * 1e6 / lookups << " ns/lookup (" << singleMs / batchMs << "x)" << std::endl;
+			std::cout << "  " << hits << " hits" << std::endl;
+		}
+
+		// Scheduler style queue: count keys preloaded, then every operation pushes a key and pops the smallest.
+		// The double ended run pops from both ends in turn, which std::priority_queue cannot do.
+		inline void PriorityQueues(size_t count, size_t operations)
+		{
+			std::vector<int> keys = RandomKeys(count + operations, 5);
+			long long checksum = 0;
+			std::cout << "Priority queues, " << count << " queued, " << operations << " push + pop, ns/op" << std::endl;
+
+			std::priority_queue<int, std::vector<int>, std::greater<int>> heap(keys.begin(), keys.begin() + count);
+			Clock::time_point start = Clock::now();
+			for (size_t i = count; i < keys.size(); i++)
+			{
+				heap.push(keys[i]);
+				checksum += heap.top();
+				heap.pop();
+			}
+			double heapMs = ElapsedMs(start);
+
+			std::multiset<int> set(keys.begin(), keys.begin() + count);
+			start = Clock::now();
+			for (size_t i = count; i < keys.size(); i++)
+			{
+				set.insert(keys[i]);
+				checksum -= *set.begin();
+				set.erase(set.begin());
+			}
+			double setMs = ElapsedMs(start);
+
+			RBTree::RBTree<int> rbTree(true);
+			rbTree.InsertBatch(keys.begin(), keys.begin() + count);
+			int key;
+			start = Clock::now();
+			for (size_t i = count; i < keys.size(); i++)
+			{
+				rbTree.InsertValue(keys[i]);
+				rbTree.PopMin(key);
+				checksum += key;
+			}
+			double rbMs = ElapsedMs(start);
+
+			AVLTree::AVLTree<int> avlTree(true);
+			avlTree.InsertBatch(keys.begin(), keys.begin() + count);
+			start = Clock::now();
+			for (size_t i = count; i < keys.size(); i++)
+			{
+				avlTree.Insert(keys[i]);
+				avlTree.PopMin(key);
+				checksum -= key;
+			}
+			double avlMs = ElapsedMs(start);
+
+			std::cout << "  std::priority_queue " << heapMs * 1e6 / operations << ", std::multiset " << setMs * 1e6 / operations
+				<< ", RBTree " << rbMs * 1e6 / operations << ", AVLTree " << avlMs * 1e6 / operations << std::endl;
+
+			// Double ended, the heap sits this one out
+			start = Clock::now();
+			for (size_t i = count; i < keys.size(); i++)
+			{
+				set.insert(keys[i]);
+				if (i & 1)
+					set.erase(set.begin());
+				else
+					set.erase(std::prev(set.end()));
+			}
+			setMs = ElapsedMs(start);
+
+			start = Clock::now();
+			for (size_t i = count; i < keys.size(); i++)
+			{
+				rbTree.InsertValue(keys[i]);
+				if (i & 1)
+					rbTree.PopMin(key);
+				else
+					rbTree.PopMax(key);
+			}
+			rbMs = ElapsedMs(start);
+
+			start = Clock::now();
+			for (size_t i = count; i < keys.size(); i++)
+			{
+				avlTree.Insert(keys[i]);
+				if (i & 1)
+					avlTree.PopMin(key);
+				else
+					avlTree.PopMax(key);
+			}
+			avlMs = ElapsedMs(start);
+
+			std::cout << "  Double ended: std::multiset " << setMs * 1e6 / operations << ", RBTree " << rbMs * 1e6 / operations
+				<< ", AVLTree " << avlMs * 1e6 / operations << " (checksum " << checksum << ")" << std::endl;
+		}
+
+		// Time keyed window: every tick appends keysPerTick keys and evicts the ones that fell out of the window.
+		// Reports the eviction time per tick for one DeleteValue per key, EraseBelow and EraseBelow with deferred freeing.
+		inline void SlidingWindow(int windowTicks, int ticks)
+		{
+			std::cout << "Sliding window, " << windowTicks << " ticks kept, ms/eviction" << std::endl;
+			for (int keysPerTick = 1000; keysPerTick <= 1000000; keysPerTick *= 10)
+			{
+				double evictMs[3] = {};
+				for (int strategy = 0; strategy < 3; strategy++)
+				{
+					RBTree::RBTree<int> tree;
+					int next = 0;
+					for (int tick = 0; tick < windowTicks + ticks; tick++)
+					{
+						for (int i = 0; i < keysPerTick; i++)
+							tree.InsertNearFinger(next++);
+
+						if (tick < windowTicks)
+							continue;
+
+						int cutoff = (tick - windowTicks + 1) * keysPerTick;
+						Clock::time_point start = Clock::now();
+						if (strategy == 0)
+						{
+							for (int key = cutoff - keysPerTick; key < cutoff; key++)
+								tree.DeleteValue(key);
+						}
+						else
+							tree.EraseBelow(cutoff, strategy == 2);
+						evictMs[strategy] += ElapsedMs(start);
+					}
+
+					if (tree.Size() != static_cast<size_t>(windowTicks) * keysPerTick)
+						std::cout << "  Unexpected size " << tree.Size() << std::endl;
+				}
+
+				std::cout << "  " << keysPerTick << " keys/tick: DeleteValue " << evictMs[0] / ticks << ", EraseBelow "
+					<< evictMs[1] / ticks << ", deferred EraseBelow " << evictMs[2] / ticks << std::endl;
+			}
+		}
+
+		// Sum of every key with the sequential in order walk against ParallelReduce at increasing thread counts
+		inline void ParallelScan(size_t count)
+		{
+			std::vector<int> keys = RandomKeys(count, 3);
+			RBTree::RBTree<int> rbTree;
+			AVLTree::AVLTree<int> avlTree;
+			rbTree.BuildParallel(keys.begin(), keys.end());
+			avlTree.BuildParallel(keys.begin(), keys.end());
+			auto add = [](long long sum, long long key) { return sum + key; };
+
+			long long rbSum = 0, avlSum = 0;
+			Clock::time_point start = Clock::now();
+			rbTree.ForEachInOrder([&](int key) { rbSum += key; });
+			double rbMs = ElapsedMs(start);
+			start = Clock::now();
+			avlTree.ForEachInOrder([&](int key) { avlSum += key; });
+			double avlMs = ElapsedMs(start);
+
+			std::cout << "Parallel scan, " << rbTree.Size() << " keys, ms" << std::endl;
+			std::cout << "  Sequential: RBTree " << rbMs << ", AVLTree " << avlMs << std::endl;
+
+			unsigned maxThreads = std::max(Parallel::ThreadCount(0), 8u);
+			for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+			{
+				start = Clock::now();
+				bool same = rbTree.ParallelReduce(0LL, add, threads) == rbSum;
+				rbMs = ElapsedMs(start);
+				start = Clock::now();
+				same = avlTree.ParallelReduce(0LL, add, threads) == avlSum && same;
+				avlMs = ElapsedMs(start);
+				std::cout << "  " << threads << " threads: RBTree " << rbMs << ", AVLTree " << avlMs << (same ? "" : " (sum mismatch)") << std::endl;
+			}
+		}
+
+		// Bursts of inserts into a growing AVL tree, balancing on every insert against relaxed mode with a
+		// Rebalance after each burst, once with random keys and once with keys past the largest one, as in a log
+		inline void RelaxedIngest(size_t burst, size_t bursts)
+		{
+			std::cout << "Relaxed ingest, " << bursts << " bursts of " << burst << " keys, ns/insert" << std::endl;
+			for (int sorted = 0; sorted < 2; sorted++)
+			{
+				std::vector<int> keys = RandomKeys(burst * bursts, 13);
+				if (sorted)
+					std::sort(keys.begin(), keys.end());
+
+				AVLTree::AVLTree<int> strictTree;
+				AVLTree::AVLTree<int> relaxedTree;
+				double strictMs = 0, relaxedMs = 0, rebalanceMs = 0;
+				for (size_t i = 0; i < bursts; i++)
+				{
+					Clock::time_point start = Clock::now();
+					for (size_t k = i * burst; k < (i + 1) * burst; k++)
+						strictTree.Insert(keys[k]);
+					strictMs += ElapsedMs(start);
+
+					relaxedTree.SetRelaxed(true);
+					start = Clock::now();
+					for (size_t k = i * burst; k < (i + 1) * burst; k++)
+						relaxedTree.Insert(keys[k]);
+					relaxedMs += ElapsedMs(start);
+
+					start = Clock::now();
+					relaxedTree.SetRelaxed(false);
+					rebalanceMs += ElapsedMs(start);
+				}
+
+				std::cout << "  " << (sorted ? "Sorted" : "Random") << " keys: balanced inserts " << strictMs * 1e6 / (burst * bursts)
+					<< ", relaxed inserts " << relaxedMs * 1e6 / (burst * bursts) << " + Rebalance " << rebalanceMs * 1e6 / (burst * bursts) << std::endl;
+			}
+		}
+
+		// A 64 entry opcode table: RBTree filled at startup against a StaticOrderedSet built by the compiler
+		inline void StaticLookups(size_t lookups)
+		{
+			static constexpr auto opcodes = StaticSet::MakeStaticSet({
+				1, 3, 4, 6, 9, 10, 12, 15, 16, 18, 21, 22, 25, 27, 28, 31,
+				33, 34, 37, 39, 40, 43, 45, 46, 49, 51, 52, 55, 57, 58, 61, 63,
+				64, 67, 69, 70, 73, 75, 76, 79, 81, 82, 85, 87, 88, 91, 93, 94,
+				97, 99, 100, 103, 105, 106, 109, 111, 112, 115, 117, 118, 121, 123, 124, 127 });
+
+			Clock::time_point start = Clock::now();
+			RBTree::RBTree<int> tree;
+			opcodes.ForEachInOrder([&](int opcode) { tree.InsertValue(opcode); });
+			double buildMs = ElapsedMs(start);
+
+			std::vector<int> probes = RandomKeys(lookups, 5);
+			for (int& probe : probes)
+				probe &= 127; // About half of them are opcodes
+
+			size_t hits = 0;
+			start = Clock::now();
+			for (int probe : probes)
+				hits += tree.Search(probe)->data == probe;
+			double treeMs = ElapsedMs(start);
+
+			start = Clock::now();
+			for (int probe : probes)
+				hits += opcodes.Contains(probe);
+			double staticMs = ElapsedMs(start);
+
+			std::cout << "Static lookups, " << opcodes.Size() << " keys (" << hits << " hits)" << std::endl;
+			std::cout << "  RBTree:           " << buildMs * 1e3 << " us to build, " << treeMs * 1e6 / lookups << " ns/lookup" << std::endl;
+			std::cout << "  StaticOrderedSet: 0 us to build, " << staticMs * 1e6 / lookups << " ns/lookup" << std::endl;
+		}
+
+		// How long dropping a tree of count keys blocks its owner, freeing on the spot against handing it to the NodeReclaimer
+		inline void Teardown(size_t count)
+		{
+			std::vector<int> keys = RandomKeys(count, 17);
+			std::cout << "Teardown, " << count << " keys, ms the owner is blocked" << std::endl;
+			for (int background = 0; background < 2; background++)
+			{
+				RBTree::RBTree<int>* tree = new RBTree::RBTree<int>();
+				tree->SetBackgroundFree(background != 0);
+				tree->InsertBatch(keys.begin(), keys.end());
+
+				Clock::time_point start = Clock::now();
+				delete tree;
+				double blockedMs = ElapsedMs(start);
+
+				start = Clock::now();
+				NodeReclaimer::Reclaimer::Instance().Wait();
+				std::cout << (background ? "  Background: " : "  In place:   ") << blockedMs
+					<< " (freed after another " << ElapsedMs(start) << ")" << std::endl;
+			}
+		}
+
+		// Overlap queries on IntervalTree against a linear scan over the same intervals
+		inline void IntervalOverlaps(size_t count, size_t queries)
+		{
+			std::mt19937 generator(11);
+			const int span = 1 << 30;
+			std::vector<IntervalTree::Interval<int>> intervals;
+			IntervalTree::IntervalTree<int> tree;
+			for (size_t i = 0; i < count; i++)
+			{
+				int lo = static_cast<int>(generator() % span);
+				int hi = lo + 1 + static_cast<int>(generator() % 4096);
+				intervals.push_back(IntervalTree::Interval<int>(lo, hi));
+				tree.Insert(lo, hi);
+			}
+
+			std::vector<int> windows(queries);
+			for (int& lo : windows)
+				lo = static_cast<int>(generator() % span);
+
+			size_t treeHits = 0;
+			Clock::time_point start = Clock::now();
+			for (int lo : windows)
+				tree.ForEachOverlap(lo, lo + 65536, [&](const IntervalTree::Interval<int>&) { treeHits++; });
+			double treeMs = ElapsedMs(start);
+
+			size_t scanHits = 0;
+			start = Clock::now();
+			for (int lo : windows)
+			{
+				for (const IntervalTree::Interval<int>& interval : intervals)
+					scanHits += interval.Overlaps(lo, lo + 65536);
+			}
+			double scanMs = ElapsedMs(start);
+
+			std::cout << "Interval overlaps, " << count << " intervals, " << queries << " queries" << std::endl;
+			std::cout << "  IntervalTree: " << treeHits << " hits, " << treeMs * 1000 / queries << " us/query" << std::endl;
+			std::cout << "  Linear scan:  " << scanHits << " hits, " << scanMs * 1000 / queries << " us/query" << std::endl;
+		}
+
+		// Runs the same mixed workload (50% search, 25% insert, 25% remove) on every thread
+		// and returns the total operations per second
+		template<typename Insert, typename Remove, typename Search>
+		double MixedWorkload(unsigned threadCount, size_t opsPerThread, int keyRange, Insert insert, Remove remove, Search search)
+		{
+			std::vector<std::thread> workers;
+			Clock::time_point start = Clock::now();
+			for (unsigned t = 0; t < threadCount; t++)
+			{
+				workers.emplace_back([=]()
+				{
+					std::mt19937 generator(t + 1);
+					for (size_t i = 0; i < opsPerThread; i++)
+					{
+						unsigned r = generator();
+						int key = static_cast<int>((r >> 2) % keyRange);
+						if ((r & 3) < 2)
+							search(key);
+						else if ((r & 3) == 2)
+							insert(key);
+						else
+							remove(key);
+					}
+				});
+			}
+
+			for (std::thread& worker : workers)
+				worker.join();
+
+			return threadCount * opsPerThread / (ElapsedMs(start) / 1000.0);
+		}
+
+		// LockFreeSkipList against a mutex wrapped RBTree at increasing thread counts
+		inline void ConcurrentSets(size_t opsPerThread)
+		{
+			const int keyRange = 1 << 16;
+			unsigned maxThreads = std::thread::hardware_concurrency();
+			if (maxThreads < 8)
+				maxThreads = 8;
+
+			std::cout << "Concurrent sets, " << opsPerThread << " ops/thread, Mops/s" << std::endl;
+			for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+			{
+				LockFreeSkipList::LockFreeSkipList<int> skipList;
+				RBTree::RBTree<int> tree;
+				std::mutex treeMutex;
+				for (int key = 0; key < keyRange; key += 2)
+				{
+					skipList.Insert(key);
+					tree.InsertValue(key);
+				}
+
+				double skipListOps = MixedWorkload(threads, opsPerThread, keyRange,
+					[&](int key) { skipList.Insert(key); },
+					[&](int key) { skipList.Remove(key); },
+					[&](int key) { skipList.Search(key); });
+
+				double treeOps = MixedWorkload(threads, opsPerThread, keyRange,
+					[&](int key) { std::lock_guard<std::mutex> lk(treeMutex); tree.InsertValue(key); },
+					[&](int key)
+					{
+						std::lock_guard<std::mutex> lk(treeMutex);
+						RBTree::Node<int>* n = tree.Search(key);
+						if (n != nullptr && n->data == key)
+							tree.DeleteValue(key);
+					},
+					[&](int key) { std::lock_guard<std::mutex> lk(treeMutex); tree.Search(key); });
+
+				std::cout << "  " << threads << " threads: LockFreeSkipList " << skipListOps / 1e6
+					<< ", mutex RBTree " << treeOps / 1e6 << std::endl;
+			}
+		}
+	}
+}
+
+#endif
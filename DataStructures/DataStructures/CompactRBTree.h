@@ -0,0 +1,492 @@
+#ifndef COMPACT_RED_BLACK_TREE_H
+#define COMPACT_RED_BLACK_TREE_H
+#include <cstdint>
+#include <vector>
+#include "RBTree.h"
+#include "TreeUtils.h"
+
+namespace myDataStructures
+{
+	namespace CompactRBTree
+	{
+		// Nodes live in one arena and link to each other through 32-bit slot indices.
+		// Slot 0 is the shared black sentinel that stands in for every null child.
+		typedef std::uint32_t Index;
+
+		const Index NIL = 0;
+		const Index COLOR_BIT = 0x80000000u;
+		const Index PARENT_MASK = 0x7FFFFFFFu;
+
+		template<typename T>
+		struct Node
+		{
+			T data;
+			Index left, right;
+			Index parentAndColor; // Parent index in the low 31 bits, the color in the top bit (set means BLACK)
+		};
+
+		// Red black tree with the same rules as RBTree::RBTree, but for an int key a node takes
+		// 16 bytes instead of the 32 of RBTree::Node<int> and all nodes are contiguous, so more of
+		// the tree stays in cache. It has no multiset counts.
+		// T must be default constructible, because the sentinel slot holds a T as well.
+		template<typename T>
+		class CompactRBTree
+		{
+		private:
+			std::vector<Node<T>> nodes;
+			Index root;
+			Index freeList; // Erased slots chained through their left index
+			size_t size;
+
+		protected:
+			Index Parent(Index n) const;
+			void SetParent(Index n, Index parent);
+			unsigned char GetColor(Index n) const;
+			void SetColor(Index n, unsigned char newColor);
+			Index Allocate(T data);
+			void Release(Index n);
+			Index MinValueNode(Index n) const;
+			void LeftRotation(Index n);
+			void RightRotation(Index n);
+			void Transplant(Index u, Index v);
+			void FixInsertRBTree(Index n);
+			void FixDoubleBlack(Index n);
+			Index Find(T data) const;
+
+		public:
+			CompactRBTree();
+
+			void InsertValue(T data);
+			void DeleteValue(T data);
+			bool Contains(T data) const;
+			size_t Size() const;
+			size_t MemoryUsage() const; // Bytes held by the node arena
+
+			void Reserve(size_t count);
+
+			template<typename F>
+			void ForEachInOrder(F&& f) const;
+		};
+
+		// Public Member Functions Implementations
+
+		template<typename T>
+		CompactRBTree<T>::CompactRBTree()
+			: root(NIL), freeList(NIL), size(0)
+		{
+			Node<T> sentinel = Node<T>();
+			sentinel.left = sentinel.right = NIL;
+			sentinel.parentAndColor = COLOR_BIT;
+			nodes.push_back(sentinel);
+		}
+
+		template<typename T>
+		void CompactRBTree<T>::InsertValue(T data)
+		{
+			Index parent = NIL;
+			Index current = root;
+			while (current != NIL)
+			{
+				parent = current;
+				if (data < nodes[current].data)
+					current = nodes[current].left;
+				else if (nodes[current].data < data)
+					current = nodes[current].right;
+				else
+					return; // Already present
+			}
+
+			// Allocate only after the descent, since growing the arena moves the nodes
+			Index n = Allocate(data);
+			SetParent(n, parent);
+			if (parent == NIL)
+				root = n;
+			else if (data < nodes[parent].data)
+				nodes[parent].left = n;
+			else
+				nodes[parent].right = n;
+
+			FixInsertRBTree(n);
+		}
+
+		template<typename T>
+		void CompactRBTree<T>::DeleteValue(T data)
+		{
+			Index z = Find(data);
+			if (z == NIL)
+				return;
+
+			Index y = z;
+			unsigned char removedColor = GetColor(y);
+			Index x;
+
+			if (nodes[z].left == NIL)
+			{
+				x = nodes[z].right;
+				Transplant(z, x);
+			}
+			else if (nodes[z].right == NIL)
+			{
+				x = nodes[z].left;
+				Transplant(z, x);
+			}
+			else
+			{
+				// Two children, the successor takes the place of z
+				y = MinValueNode(nodes[z].right);
+				removedColor = GetColor(y);
+				x = nodes[y].right;
+				if (Parent(y) == z)
+				{
+					SetParent(x, y);
+				}
+				else
+				{
+					Transplant(y, x);
+					nodes[y].right = nodes[z].right;
+					SetParent(nodes[y].right, y);
+				}
+
+				Transplant(z, y);
+				nodes[y].left = nodes[z].left;
+				SetParent(nodes[y].left, y);
+				SetColor(y, GetColor(z));
+			}
+
+			if (removedColor == RBTree::Color::BLACK)
+				FixDoubleBlack(x);
+
+			Release(z);
+		}
+
+		template<typename T>
+		bool CompactRBTree<T>::Contains(T data) const
+		{
+			return Find(data) != NIL;
+		}
+
+		template<typename T>
+		size_t CompactRBTree<T>::Size() const
+		{
+			return size;
+		}
+
+		template<typename T>
+		size_t CompactRBTree<T>::MemoryUsage() const
+		{
+			return nodes.capacity() * sizeof(Node<T>);
+		}
+
+		template<typename T>
+		void CompactRBTree<T>::Reserve(size_t count)
+		{
+			nodes.reserve(count + 1);
+		}
+
+		template<typename T>
+		template<typename F>
+		void CompactRBTree<T>::ForEachInOrder(F&& f) const
+		{
+			if (root == NIL)
+				return;
+
+			Index n = MinValueNode(root);
+			while (n != NIL)
+			{
+				if (!TreeUtils::Visit(f, static_cast<const T&>(nodes[n].data)))
+					return;
+
+				if (nodes[n].right != NIL)
+				{
+					n = MinValueNode(nodes[n].right);
+				}
+				else
+				{
+					Index parent = Parent(n);
+					while (parent != NIL && n == nodes[parent].right)
+					{
+						n = parent;
+						parent = Parent(parent);
+					}
+					n = parent;
+				}
+			}
+		}
+
+		// Protected Member Functions Implementations
+
+		template<typename T>
+		inline Index CompactRBTree<T>::Parent(Index n) const
+		{
+			return nodes[n].parentAndColor & PARENT_MASK;
+		}
+
+		template<typename T>
+		inline void CompactRBTree<T>::SetParent(Index n, Index parent)
+		{
+			nodes[n].parentAndColor = (nodes[n].parentAndColor & COLOR_BIT) | parent;
+		}
+
+		template<typename T>
+		inline unsigned char CompactRBTree<T>::GetColor(Index n) const
+		{
+			return (nodes[n].parentAndColor & COLOR_BIT) ? RBTree::Color::BLACK : RBTree::Color::RED;
+		}
+
+		template<typename T>
+		inline void CompactRBTree<T>::SetColor(Index n, unsigned char newColor)
+		{
+			if (newColor == RBTree::Color::BLACK)
+				nodes[n].parentAndColor |= COLOR_BIT;
+			else
+				nodes[n].parentAndColor &= PARENT_MASK;
+		}
+
+		template<typename T>
+		Index CompactRBTree<T>::Allocate(T data)
+		{
+			Index n = freeList;
+			if (n != NIL)
+			{
+				freeList = nodes[n].left;
+			}
+			else
+			{
+				n = static_cast<Index>(nodes.size());
+				nodes.push_back(Node<T>());
+			}
+
+			// New nodes are red leaves
+			nodes[n].data = data;
+			nodes[n].left = nodes[n].right = NIL;
+			nodes[n].parentAndColor = NIL;
+			size++;
+			return n;
+		}
+
+		template<typename T>
+		void CompactRBTree<T>::Release(Index n)
+		{
+			nodes[n].left = freeList;
+			freeList = n;
+			size--;
+		}
+
+		template<typename T>
+		Index CompactRBTree<T>::MinValueNode(Index n) const
+		{
+			while (nodes[n].left != NIL)
+				n = nodes[n].left;
+
+			return n;
+		}
+
+		template<typename T>
+		void CompactRBTree<T>::LeftRotation(Index n)
+		{
+			Index rightChild = nodes[n].right;
+			nodes[n].right = nodes[rightChild].left;
+
+			if (nodes[n].right != NIL)
+				SetParent(nodes[n].right, n);
+
+			Transplant(n, rightChild);
+			nodes[rightChild].left = n;
+			SetParent(n, rightChild);
+		}
+
+		template<typename T>
+		void CompactRBTree<T>::RightRotation(Index n)
+		{
+			Index leftChild = nodes[n].left;
+			nodes[n].left = nodes[leftChild].right;
+
+			if (nodes[n].left != NIL)
+				SetParent(nodes[n].left, n);
+
+			Transplant(n, leftChild);
+			nodes[leftChild].right = n;
+			SetParent(n, leftChild);
+		}
+
+		template<typename T>
+		// puts v where u hangs from its parent, v may be the sentinel
+		void CompactRBTree<T>::Transplant(Index u, Index v)
+		{
+			Index parent = Parent(u);
+			if (parent == NIL)
+				root = v;
+			else if (u == nodes[parent].left)
+				nodes[parent].left = v;
+			else
+				nodes[parent].right = v;
+
+			SetParent(v, parent);
+		}
+
+		template<typename T>
+		void CompactRBTree<T>::FixInsertRBTree(Index n)
+		{
+			while (GetColor(Parent(n)) == RBTree::Color::RED)
+			{
+				Index parent = Parent(n);
+				Index grandParent = Parent(parent);
+
+				if (parent == nodes[grandParent].left)
+				{
+					Index uncle = nodes[grandParent].right;
+					if (GetColor(uncle) == RBTree::Color::RED)
+					{
+						// Color shift
+						SetColor(parent, RBTree::Color::BLACK);
+						SetColor(uncle, RBTree::Color::BLACK);
+						SetColor(grandParent, RBTree::Color::RED);
+						n = grandParent;
+					}
+					else
+					{
+						if (n == nodes[parent].right)
+						{
+							n = parent;
+							LeftRotation(n);
+							parent = Parent(n);
+						}
+
+						SetColor(parent, RBTree::Color::BLACK);
+						SetColor(grandParent, RBTree::Color::RED);
+						RightRotation(grandParent);
+					}
+				}
+				else
+				{
+					Index uncle = nodes[grandParent].left;
+					if (GetColor(uncle) == RBTree::Color::RED)
+					{
+						SetColor(parent, RBTree::Color::BLACK);
+						SetColor(uncle, RBTree::Color::BLACK);
+						SetColor(grandParent, RBTree::Color::RED);
+						n = grandParent;
+					}
+					else
+					{
+						if (n == nodes[parent].left)
+						{
+							n = parent;
+							RightRotation(n);
+							parent = Parent(n);
+						}
+
+						SetColor(parent, RBTree::Color::BLACK);
+						SetColor(grandParent, RBTree::Color::RED);
+						LeftRotation(grandParent);
+					}
+				}
+			}
+
+			SetColor(root, RBTree::Color::BLACK);
+		}
+
+		template<typename T>
+		void CompactRBTree<T>::FixDoubleBlack(Index x)
+		{
+			while (x != root && GetColor(x) == RBTree::Color::BLACK)
+			{
+				Index parent = Parent(x);
+				if (x == nodes[parent].left)
+				{
+					Index sibling = nodes[parent].right;
+					if (GetColor(sibling) == RBTree::Color::RED)
+					{
+						// Sibling Red
+						SetColor(sibling, RBTree::Color::BLACK);
+						SetColor(parent, RBTree::Color::RED);
+						LeftRotation(parent);
+						sibling = nodes[parent].right;
+					}
+
+					if (GetColor(nodes[sibling].left) == RBTree::Color::BLACK
+						&& GetColor(nodes[sibling].right) == RBTree::Color::BLACK)
+					{
+						// Sibling has 2 black children, double black pushed up
+						SetColor(sibling, RBTree::Color::RED);
+						x = parent;
+					}
+					else
+					{
+						if (GetColor(nodes[sibling].right) == RBTree::Color::BLACK)
+						{
+							// Right Left
+							SetColor(nodes[sibling].left, RBTree::Color::BLACK);
+							SetColor(sibling, RBTree::Color::RED);
+							RightRotation(sibling);
+							sibling = nodes[parent].right;
+						}
+
+						// Right Right
+						SetColor(sibling, GetColor(parent));
+						SetColor(parent, RBTree::Color::BLACK);
+						SetColor(nodes[sibling].right, RBTree::Color::BLACK);
+						LeftRotation(parent);
+						x = root;
+					}
+				}
+				else
+				{
+					Index sibling = nodes[parent].left;
+					if (GetColor(sibling) == RBTree::Color::RED)
+					{
+						SetColor(sibling, RBTree::Color::BLACK);
+						SetColor(parent, RBTree::Color::RED);
+						RightRotation(parent);
+						sibling = nodes[parent].left;
+					}
+
+					if (GetColor(nodes[sibling].left) == RBTree::Color::BLACK
+						&& GetColor(nodes[sibling].right) == RBTree::Color::BLACK)
+					{
+						SetColor(sibling, RBTree::Color::RED);
+						x = parent;
+					}
+					else
+					{
+						if (GetColor(nodes[sibling].left) == RBTree::Color::BLACK)
+						{
+							// Left Right
+							SetColor(nodes[sibling].right, RBTree::Color::BLACK);
+							SetColor(sibling, RBTree::Color::RED);
+							LeftRotation(sibling);
+							sibling = nodes[parent].left;
+						}
+
+						// Left Left
+						SetColor(sibling, GetColor(parent));
+						SetColor(parent, RBTree::Color::BLACK);
+						SetColor(nodes[sibling].left, RBTree::Color::BLACK);
+						RightRotation(parent);
+						x = root;
+					}
+				}
+			}
+
+			SetColor(x, RBTree::Color::BLACK);
+		}
+
+		template<typename T>
+		Index CompactRBTree<T>::Find(T data) const
+		{
+			Index current = root;
+			while (current != NIL)
+			{
+				if (data < nodes[current].data)
+					current = nodes[current].left;
+				else if (nodes[current].data < data)
+					current = nodes[current].right;
+				else
+					break;
+			}
+
+			return current;
+		}
+	}
+}
+#endif
@@ -0,0 +1,188 @@
+#ifndef EPOCH_RECLAMATION_H
+#define EPOCH_RECLAMATION_H
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace myDataStructures
+{
+	namespace EpochReclamation
+	{
+		struct Retired
+		{
+			void* pointer;
+			void (*deleter)(void*);
+			std::uint64_t epoch; // Global epoch when it was retired
+		};
+
+		// One per thread, reused by later threads once its owner exits
+		struct Record
+		{
+			Record() : state(0), inUse(true), next(nullptr), depth(0) {}
+
+			std::atomic<std::uint64_t> state; // Announced epoch shifted left by one, the low bit is set while inside a critical section
+			std::atomic<bool> inUse;
+			Record* next;
+			unsigned depth; // Nesting of guards on the owning thread
+			std::vector<Retired> retired;
+		};
+
+		// Objects unlinked from a lock-free structure are retired here and freed only once the
+		// global epoch moved two steps past their retirement, so no thread can still be reading them.
+		class Domain
+		{
+		private:
+			std::atomic<std::uint64_t> epoch;
+			std::atomic<Record*> records;
+
+			static const size_t CollectInterval = 64;
+
+			Record* Acquire();
+			void TryAdvance();
+			void Collect(Record* r);
+
+		public:
+			Domain() : epoch(0), records(nullptr) {}
+			~Domain();
+
+			Domain(const Domain&) = delete;
+			Domain& operator = (const Domain&) = delete;
+
+			static Domain& Instance();
+
+			Record* Current();
+			void Enter();
+			void Exit();
+			void Retire(void* pointer, void (*deleter)(void*));
+		};
+
+		// Keeps the calling thread inside a critical section for its lifetime
+		class Guard
+		{
+		public:
+			Guard() { Domain::Instance().Enter(); }
+			~Guard() { Domain::Instance().Exit(); }
+
+			Guard(const Guard&) = delete;
+			Guard& operator = (const Guard&) = delete;
+		};
+
+		struct RecordHolder
+		{
+			RecordHolder() : record(nullptr) {}
+			~RecordHolder()
+			{
+				// Pending retirements stay in the record and are freed by its next owner
+				if (record != nullptr)
+					record->inUse.store(false, std::memory_order_release);
+			}
+
+			Record* record;
+		};
+
+		inline Domain& Domain::Instance()
+		{
+			static Domain domain;
+			return domain;
+		}
+
+		inline Domain::~Domain()
+		{
+			// Only runs at exit, when no thread is inside a critical section anymore
+			Record* r = records.load();
+			while (r != nullptr)
+			{
+				for (const Retired& item : r->retired)
+					item.deleter(item.pointer);
+
+				Record* next = r->next;
+				delete r;
+				r = next;
+			}
+		}
+
+		inline Record* Domain::Acquire()
+		{
+			for (Record* r = records.load(std::memory_order_acquire); r != nullptr; r = r->next)
+			{
+				bool expected = false;
+				if (r->inUse.compare_exchange_strong(expected, true))
+					return r;
+			}
+
+			Record* r = new Record();
+			Record* head = records.load(std::memory_order_relaxed);
+			do
+			{
+				r->next = head;
+			} while (!records.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+
+			return r;
+		}
+
+		inline Record* Domain::Current()
+		{
+			thread_local RecordHolder holder;
+			if (holder.record == nullptr)
+				holder.record = Acquire();
+
+			return holder.record;
+		}
+
+		inline void Domain::Enter()
+		{
+			Record* r = Current();
+			if (r->depth++ == 0)
+				r->state.store((epoch.load() << 1) | 1);
+		}
+
+		inline void Domain::Exit()
+		{
+			Record* r = Current();
+			if (--r->depth == 0)
+				r->state.store(0, std::memory_order_release);
+		}
+
+		inline void Domain::Retire(void* pointer, void (*deleter)(void*))
+		{
+			Record* r = Current();
+			Retired item = { pointer, deleter, epoch.load() };
+			r->retired.push_back(item);
+
+			if (r->retired.size() % CollectInterval == 0)
+				Collect(r);
+		}
+
+		inline void Domain::TryAdvance()
+		{
+			std::uint64_t current = epoch.load();
+			for (Record* r = records.load(std::memory_order_acquire); r != nullptr; r = r->next)
+			{
+				std::uint64_t state = r->state.load();
+				if ((state & 1) && (state >> 1) != current)
+					return; // Someone still works in an older epoch
+			}
+
+			epoch.compare_exchange_strong(current, current + 1);
+		}
+
+		inline void Domain::Collect(Record* r)
+		{
+			TryAdvance();
+			std::uint64_t current = epoch.load();
+
+			size_t kept = 0;
+			for (size_t i = 0; i < r->retired.size(); i++)
+			{
+				if (r->retired[i].epoch + 2 <= current)
+					r->retired[i].deleter(r->retired[i].pointer);
+				else
+					r->retired[kept++] = r->retired[i];
+			}
+
+			r->retired.resize(kept);
+		}
+	}
+}
+
+#endif
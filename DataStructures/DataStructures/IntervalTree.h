@@ -0,0 +1,158 @@
+#ifndef INTERVAL_TREE_H
+#define INTERVAL_TREE_H
+#include <ostream>
+#include "RBTree.h"
+#include "TreeUtils.h"
+
+namespace myDataStructures
+{
+	namespace IntervalTree
+	{
+		// Half open range [lo, hi), ordered by lo and then hi.
+		// maxHi is maintained by the tree and holds the largest hi in the node's subtree.
+		template<typename K>
+		struct Interval
+		{
+			Interval() : lo(), hi(), maxHi() {}
+			Interval(K lo, K hi) : lo(lo), hi(hi), maxHi(hi) {}
+
+			K lo, hi;
+			K maxHi;
+
+			bool Overlaps(K queryLo, K queryHi) const { return lo < queryHi && queryLo < hi; }
+		};
+
+		template<typename K>
+		bool operator < (const Interval<K>& a, const Interval<K>& b)
+		{
+			return a.lo < b.lo || (!(b.lo < a.lo) && a.hi < b.hi);
+		}
+
+		template<typename K>
+		bool operator == (const Interval<K>& a, const Interval<K>& b)
+		{
+			return !(a < b) && !(b < a);
+		}
+
+		template<typename K>
+		bool operator != (const Interval<K>& a, const Interval<K>& b)
+		{
+			return !(a == b);
+		}
+
+		template<typename K>
+		std::ostream& operator << (std::ostream& out, const Interval<K>& interval)
+		{
+			return out << "[" << interval.lo << ", " << interval.hi << ")";
+		}
+	}
+
+	namespace RBTree
+	{
+		template<typename K>
+		struct NodeAugmentation<IntervalTree::Interval<K>>
+		{
+			static const bool Enabled = true;
+
+			static void Update(Node<IntervalTree::Interval<K>>* n)
+			{
+				K maxHi = n->data.hi;
+				if (n->left != nullptr && maxHi < n->left->data.maxHi)
+					maxHi = n->left->data.maxHi;
+				if (n->right != nullptr && maxHi < n->right->data.maxHi)
+					maxHi = n->right->data.maxHi;
+
+				n->data.maxHi = maxHi;
+			}
+		};
+	}
+
+	namespace IntervalTree
+	{
+		// Red black tree of intervals augmented with the subtree max endpoint,
+		// so overlap queries skip every subtree that ends before the query window.
+		template<typename K>
+		class IntervalTree : public RBTree::RBTree<Interval<K>>
+		{
+		protected:
+			typedef RBTree::Node<Interval<K>> IntervalNode;
+
+			template<typename F>
+			bool ForEachOverlap(IntervalNode* n, K lo, K hi, F& f) const;
+
+		public:
+			void Insert(K lo, K hi);
+			void Remove(K lo, K hi);
+
+			// Any interval overlapping [lo, hi) in O(log n), nullptr when none does
+			const Interval<K>* FindAnyOverlap(K lo, K hi) const;
+
+			// Visits every interval overlapping [lo, hi) in order. Pruning by the subtree maxima keeps it to
+			// O(k log(n / k) + log n) for k matches, and never more than O(n).
+			// The visitor may return false to stop early.
+			template<typename F>
+			void ForEachOverlap(K lo, K hi, F&& f) const;
+		};
+
+		template<typename K>
+		void IntervalTree<K>::Insert(K lo, K hi)
+		{
+			this->InsertValue(Interval<K>(lo, hi));
+		}
+
+		template<typename K>
+		void IntervalTree<K>::Remove(K lo, K hi)
+		{
+			this->DeleteValue(Interval<K>(lo, hi));
+		}
+
+		template<typename K>
+		const Interval<K>* IntervalTree<K>::FindAnyOverlap(K lo, K hi) const
+		{
+			IntervalNode* n = this->root;
+			while (n != nullptr)
+			{
+				if (n->data.Overlaps(lo, hi))
+					return &n->data;
+
+				// If the left subtree reaches past lo but holds no overlap, nothing to the right does either
+				if (n->left != nullptr && lo < n->left->data.maxHi)
+					n = n->left;
+				else
+					n = n->right;
+			}
+
+			return nullptr;
+		}
+
+		template<typename K>
+		template<typename F>
+		void IntervalTree<K>::ForEachOverlap(K lo, K hi, F&& f) const
+		{
+			ForEachOverlap(this->root, lo, hi, f);
+		}
+
+		template<typename K>
+		template<typename F>
+		bool IntervalTree<K>::ForEachOverlap(IntervalNode* n, K lo, K hi, F& f) const
+		{
+			// Nothing in this subtree ends after lo
+			if (n == nullptr || !(lo < n->data.maxHi))
+				return true;
+
+			if (!ForEachOverlap(n->left, lo, hi, f))
+				return false;
+
+			// Everything from here on starts at or after n, so stop once n starts past the window
+			if (!(n->data.lo < hi))
+				return true;
+
+			if (n->data.Overlaps(lo, hi) && !TreeUtils::Visit(f, static_cast<const Interval<K>&>(n->data)))
+				return false;
+
+			return ForEachOverlap(n->right, lo, hi, f);
+		}
+	}
+}
+
+#endif
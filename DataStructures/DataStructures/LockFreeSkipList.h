@@ -0,0 +1,338 @@
+#ifndef LOCK_FREE_SKIP_LIST_H
+#define LOCK_FREE_SKIP_LIST_H
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include "EpochReclamation.h"
+#include "Trace.h"
+#include "TreeUtils.h"
+
+namespace myDataStructures
+{
+	namespace LockFreeSkipList
+	{
+		const int MaxLevel = 24;
+
+		// The next links follow the node in the same allocation, one per level up to topLevel.
+		// The low bit of a link marks the node that owns it as logically deleted on that level.
+		template<typename T>
+		struct alignas(std::atomic<std::uintptr_t>) Node
+		{
+			Node(const T& key, int topLevel) : key(key), topLevel(topLevel), pendingRelease(2) {}
+
+			T key;
+			int topLevel;
+			std::atomic<int> pendingRelease; // The inserter and the remover both drop one, the last one retires the node
+
+			std::atomic<std::uintptr_t>* Next() { return reinterpret_cast<std::atomic<std::uintptr_t>*>(this + 1); }
+		};
+
+		// Ordered set that many threads may insert into, remove from and search at the same time.
+		// Levels are linked with CAS, removal marks the links first and unlinks them afterwards,
+		// and unlinked nodes are freed through epoch based reclamation.
+		template<typename T>
+		class LockFreeSkipList
+		{
+		private:
+			Node<T>* head;
+			std::atomic<size_t> size;
+
+		protected:
+			static Node<T>* CreateNode(const T& key, int topLevel);
+			static void DestroyNode(void* n);
+			static Node<T>* Pointer(std::uintptr_t link) { return reinterpret_cast<Node<T>*>(link & ~std::uintptr_t(1)); }
+			static bool IsMarked(std::uintptr_t link) { return (link & 1) != 0; }
+			static std::uintptr_t Link(Node<T>* n) { return reinterpret_cast<std::uintptr_t>(n); }
+			static int RandomLevel();
+
+			bool Find(const T& key, Node<T>** preds, Node<T>** succs);
+			void Release(Node<T>* n);
+
+		public:
+			LockFreeSkipList();
+			~LockFreeSkipList();
+
+			LockFreeSkipList(const LockFreeSkipList&) = delete;
+			LockFreeSkipList& operator = (const LockFreeSkipList&) = delete;
+
+			bool Insert(const T& key);
+			bool Remove(const T& key);
+			bool Search(const T& key) const;
+			size_t Size() const;
+
+			// Visits keys in ascending order. Concurrent updates may or may not be seen.
+			template<typename F>
+			void ForEachInOrder(F&& f) const;
+		};
+
+		// Public Member Functions Implementations
+
+		template<typename T>
+		LockFreeSkipList<T>::LockFreeSkipList()
+			: head(CreateNode(T(), MaxLevel - 1)), size(0)
+		{
+		}
+
+		template<typename T>
+		LockFreeSkipList<T>::~LockFreeSkipList()
+		{
+			// Removed nodes are already unlinked and owned by the reclamation domain
+			Node<T>* n = head;
+			while (n != nullptr)
+			{
+				Node<T>* next = Pointer(n->Next()[0].load(std::memory_order_relaxed));
+				DestroyNode(n);
+				n = next;
+			}
+		}
+
+		template<typename T>
+		bool LockFreeSkipList<T>::Insert(const T& key)
+		{
+			MYDS_TRACE(LockFreeSkipList, Insert, key);
+			EpochReclamation::Guard guard;
+			Node<T>* preds[MaxLevel];
+			Node<T>* succs[MaxLevel];
+			int topLevel = RandomLevel();
+
+			while (true)
+			{
+				if (Find(key, preds, succs))
+					return false;
+
+				Node<T>* n = CreateNode(key, topLevel);
+				for (int level = 0; level <= topLevel; level++)
+					n->Next()[level].store(Link(succs[level]), std::memory_order_relaxed);
+
+				// Linking the bottom level makes the key present
+				std::uintptr_t expected = Link(succs[0]);
+				if (!preds[0]->Next()[0].compare_exchange_strong(expected, Link(n)))
+				{
+					DestroyNode(n); // Never published
+					continue;
+				}
+
+				size.fetch_add(1, std::memory_order_relaxed);
+
+				for (int level = 1; level <= topLevel; level++)
+				{
+					while (true)
+					{
+						// A successor with the same key is a removed node not yet unlinked on this level,
+						// linking in front of it would hide it from the remover's cleanup
+						if (succs[level] != nullptr && !(key < succs[level]->key))
+						{
+							Find(key, preds, succs);
+							if (succs[0] != n)
+								goto linked; // Removed meanwhile
+							continue;
+						}
+
+						std::uintptr_t current = n->Next()[level].load();
+						if (IsMarked(current))
+							goto linked; // Removed meanwhile, stop raising it
+
+						if (Pointer(current) != succs[level] && !n->Next()[level].compare_exchange_strong(current, Link(succs[level])))
+							goto linked;
+
+						expected = Link(succs[level]);
+						if (preds[level]->Next()[level].compare_exchange_strong(expected, Link(n)))
+							break;
+
+						Find(key, preds, succs);
+						if (succs[0] != n)
+							goto linked;
+					}
+				}
+
+			linked:
+				// A remover may have finished before the last levels were linked, unlink them again
+				if (IsMarked(n->Next()[0].load()))
+					Find(key, preds, succs);
+
+				Release(n);
+				return true;
+			}
+		}
+
+		template<typename T>
+		bool LockFreeSkipList<T>::Remove(const T& key)
+		{
+			MYDS_TRACE(LockFreeSkipList, Delete, key);
+			EpochReclamation::Guard guard;
+			Node<T>* preds[MaxLevel];
+			Node<T>* succs[MaxLevel];
+
+			if (!Find(key, preds, succs))
+				return false;
+
+			Node<T>* victim = succs[0];
+
+			// Mark the upper levels top down, then the bottom level decides who removed it
+			for (int level = victim->topLevel; level >= 1; level--)
+			{
+				std::uintptr_t link = victim->Next()[level].load();
+				while (!IsMarked(link))
+					victim->Next()[level].compare_exchange_weak(link, link | 1);
+			}
+
+			std::uintptr_t link = victim->Next()[0].load();
+			while (!IsMarked(link))
+			{
+				if (victim->Next()[0].compare_exchange_strong(link, link | 1))
+				{
+					size.fetch_sub(1, std::memory_order_relaxed);
+					Find(key, preds, succs); // Unlinks it from every level
+					Release(victim);
+					return true;
+				}
+			}
+
+			return false; // Another thread removed it first
+		}
+
+		template<typename T>
+		bool LockFreeSkipList<T>::Search(const T& key) const
+		{
+			MYDS_TRACE(LockFreeSkipList, Search, key);
+			EpochReclamation::Guard guard;
+			Node<T>* pred = head;
+			Node<T>* current = nullptr;
+
+			for (int level = MaxLevel - 1; level >= 0; level--)
+			{
+				current = Pointer(pred->Next()[level].load(std::memory_order_acquire));
+				while (current != nullptr)
+				{
+					std::uintptr_t next = current->Next()[level].load(std::memory_order_acquire);
+					if (IsMarked(next))
+					{
+						// Skip removed nodes without helping to unlink them
+						current = Pointer(next);
+						continue;
+					}
+
+					if (!(current->key < key))
+						break;
+
+					pred = current;
+					current = Pointer(next);
+				}
+			}
+
+			return current != nullptr && !(key < current->key);
+		}
+
+		template<typename T>
+		size_t LockFreeSkipList<T>::Size() const
+		{
+			return size.load(std::memory_order_relaxed);
+		}
+
+		template<typename T>
+		template<typename F>
+		void LockFreeSkipList<T>::ForEachInOrder(F&& f) const
+		{
+			EpochReclamation::Guard guard;
+			Node<T>* n = Pointer(head->Next()[0].load(std::memory_order_acquire));
+			while (n != nullptr)
+			{
+				std::uintptr_t next = n->Next()[0].load(std::memory_order_acquire);
+				if (!IsMarked(next) && !TreeUtils::Visit(f, static_cast<const T&>(n->key)))
+					return;
+
+				n = Pointer(next);
+			}
+		}
+
+		// Protected Member Functions Implementations
+
+		template<typename T>
+		Node<T>* LockFreeSkipList<T>::CreateNode(const T& key, int topLevel)
+		{
+			void* memory = ::operator new(sizeof(Node<T>) + (topLevel + 1) * sizeof(std::atomic<std::uintptr_t>));
+			Node<T>* n = new (memory) Node<T>(key, topLevel);
+			for (int level = 0; level <= topLevel; level++)
+				new (&n->Next()[level]) std::atomic<std::uintptr_t>(0);
+
+			return n;
+		}
+
+		template<typename T>
+		void LockFreeSkipList<T>::DestroyNode(void* pointer)
+		{
+			Node<T>* n = static_cast<Node<T>*>(pointer);
+			n->~Node<T>();
+			::operator delete(pointer);
+		}
+
+		template<typename T>
+		int LockFreeSkipList<T>::RandomLevel()
+		{
+			// xorshift per thread, each level is kept with probability 1/2
+			thread_local std::uint32_t state = 2463534242u ^ static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(&state));
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+
+			int level = 0;
+			std::uint32_t bits = state;
+			while ((bits & 1) && level < MaxLevel - 1)
+			{
+				level++;
+				bits >>= 1;
+			}
+
+			return level;
+		}
+
+		template<typename T>
+		// fills the last node before key and the first node at or after key on every level,
+		// unlinking marked nodes on the way, and returns whether key is present
+		bool LockFreeSkipList<T>::Find(const T& key, Node<T>** preds, Node<T>** succs)
+		{
+		retry:
+			Node<T>* pred = head;
+			Node<T>* current = nullptr;
+
+			for (int level = MaxLevel - 1; level >= 0; level--)
+			{
+				current = Pointer(pred->Next()[level].load(std::memory_order_acquire));
+				while (current != nullptr)
+				{
+					std::uintptr_t next = current->Next()[level].load(std::memory_order_acquire);
+					if (IsMarked(next))
+					{
+						// Unlink it, fails when pred itself was marked or changed
+						std::uintptr_t expected = Link(current);
+						if (!pred->Next()[level].compare_exchange_strong(expected, Link(Pointer(next))))
+							goto retry;
+
+						current = Pointer(next);
+						continue;
+					}
+
+					if (!(current->key < key))
+						break;
+
+					pred = current;
+					current = Pointer(next);
+				}
+
+				preds[level] = pred;
+				succs[level] = current;
+			}
+
+			return current != nullptr && !(key < current->key);
+		}
+
+		template<typename T>
+		void LockFreeSkipList<T>::Release(Node<T>* n)
+		{
+			if (n->pendingRelease.fetch_sub(1) == 1)
+				EpochReclamation::Domain::Instance().Retire(n, &LockFreeSkipList<T>::DestroyNode);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef NODE_RECLAIMER_H
+#define NODE_RECLAIMER_H
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include "TreeUtils.h"
+
+namespace myDataStructures
+{
+	namespace NodeReclaimer
+	{
+		// A detached subtree waiting to be freed. step frees up to a number of steps of it
+		// and moves node to what is left, so one type of queue serves every node type.
+		struct Pending
+		{
+			void* node;
+			size_t (*step)(void*& node, size_t steps);
+			size_t freed;
+			std::promise<size_t> done;
+		};
+
+		template<typename NodeT>
+		size_t FreeStep(void*& node, size_t steps)
+		{
+			NodeT* n = static_cast<NodeT*>(node);
+			size_t freed = TreeUtils::FreeNodes(n, steps);
+			node = n;
+			return freed;
+		}
+
+		// One background thread that frees subtrees which are no longer reachable from any tree, so
+		// dropping a huge tree costs its owner O(1). Subtrees are freed in batches of BatchSteps
+		// rotations and frees, yielding in between, so the thread never holds the allocator for long.
+		// Subtrees handed over during static destruction must be handed over before the reclaimer
+		// itself is destroyed, which frees everything still queued before returning.
+		class Reclaimer
+		{
+		private:
+			std::mutex mutex;
+			std::condition_variable wake;
+			std::condition_variable idle;
+			std::deque<Pending> pending;
+			bool busy; // The worker holds a subtree taken off the queue
+			bool stopping;
+			std::thread worker;
+
+			void Work();
+
+		public:
+			static const size_t BatchSteps = 4096;
+
+			Reclaimer();
+			~Reclaimer();
+
+			Reclaimer(const Reclaimer&) = delete;
+			Reclaimer& operator = (const Reclaimer&) = delete;
+
+			// Started on first use
+			static Reclaimer& Instance();
+
+			// Takes ownership of the subtree under n. The future gets its node count once it is freed.
+			template<typename NodeT>
+			std::future<size_t> Reclaim(NodeT* n);
+			// Blocks until everything handed over so far is freed
+			void Wait();
+		};
+
+		inline Reclaimer::Reclaimer() : busy(false), stopping(false)
+		{
+			worker = std::thread([this]() { Work(); });
+		}
+
+		inline Reclaimer::~Reclaimer()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+
+			wake.notify_all();
+			worker.join();
+		}
+
+		inline Reclaimer& Reclaimer::Instance()
+		{
+			static Reclaimer reclaimer;
+			return reclaimer;
+		}
+
+		inline void Reclaimer::Work()
+		{
+			while (true)
+			{
+				Pending current;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [this]() { return stopping || !pending.empty(); });
+					if (pending.empty())
+						return;
+
+					current = std::move(pending.front());
+					pending.pop_front();
+					busy = true;
+				}
+
+				while (true)
+				{
+					current.freed += current.step(current.node, BatchSteps);
+					if (current.node == nullptr)
+						break;
+
+					std::this_thread::yield();
+				}
+
+				current.done.set_value(current.freed);
+				std::lock_guard<std::mutex> lock(mutex);
+				busy = false;
+				if (pending.empty())
+					idle.notify_all();
+			}
+		}
+
+		template<typename NodeT>
+		std::future<size_t> Reclaimer::Reclaim(NodeT* n)
+		{
+			Pending subtree;
+			subtree.node = n;
+			subtree.step = &FreeStep<NodeT>;
+			subtree.freed = 0;
+			std::future<size_t> count = subtree.done.get_future();
+			if (n == nullptr)
+			{
+				subtree.done.set_value(0);
+				return count;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending.push_back(std::move(subtree));
+			}
+
+			wake.notify_one();
+			return count;
+		}
+
+		inline void Reclaimer::Wait()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			idle.wait(lock, [this]() { return pending.empty() && !busy; });
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace myDataStructures
+{
+	namespace Parallel
+	{
+		// Threads to use when the caller passes 0
+		inline unsigned ThreadCount(unsigned requested)
+		{
+			if (requested != 0)
+				return requested;
+
+			unsigned hardware = std::thread::hardware_concurrency();
+			return hardware != 0 ? hardware : 1;
+		}
+
+		// How many levels of a recursive split keep every thread busy
+		inline unsigned SplitDepth(unsigned threads)
+		{
+			unsigned depth = 0;
+			while ((1u << depth) < threads)
+				depth++;
+
+			return depth;
+		}
+
+		// Calls f(begin, end) on contiguous slices of [0, count), one slice per thread
+		template<typename F>
+		void For(size_t count, unsigned threads, F f)
+		{
+			threads = ThreadCount(threads);
+			if (threads > count)
+				threads = count > 0 ? static_cast<unsigned>(count) : 1;
+
+			std::vector<std::thread> workers;
+			size_t slice = (count + threads - 1) / threads;
+			for (unsigned t = 1; t < threads; t++)
+			{
+				size_t begin = std::min(count, t * slice);
+				size_t end = std::min(count, begin + slice);
+				workers.emplace_back([=]() { f(begin, end); });
+			}
+
+			f(0, std::min(count, slice));
+			for (std::thread& worker : workers)
+				worker.join();
+		}
+
+		// Runs first on a new thread and second on the caller when parallel is set, one after the other otherwise
+		template<typename F, typename G>
+		void Invoke(bool parallel, F&& first, G&& second)
+		{
+			if (!parallel)
+			{
+				first();
+				second();
+				return;
+			}
+
+			std::thread worker(first);
+			second();
+			worker.join();
+		}
+
+		// Sorts slices on every thread, then merges neighbouring slices pairwise, each round in parallel
+		template<typename T>
+		void Sort(std::vector<T>& values, unsigned threads)
+		{
+			threads = ThreadCount(threads);
+			size_t slice = (values.size() + threads - 1) / threads;
+			if (threads == 1 || slice < 4096)
+			{
+				std::sort(values.begin(), values.end());
+				return;
+			}
+
+			For(values.size(), threads, [&](size_t begin, size_t end)
+			{
+				std::sort(values.begin() + begin, values.begin() + end);
+			});
+
+			std::vector<T> buffer(values.size());
+			for (size_t width = slice; width < values.size(); width *= 2)
+			{
+				size_t pairs = (values.size() + 2 * width - 1) / (2 * width);
+				For(pairs, threads, [&](size_t first, size_t last)
+				{
+					for (size_t pair = first; pair < last; pair++)
+					{
+						size_t begin = pair * 2 * width;
+						size_t mid = std::min(values.size(), begin + width);
+						size_t end = std::min(values.size(), begin + 2 * width);
+						std::merge(values.begin() + begin, values.begin() + mid,
+							values.begin() + mid, values.begin() + end, buffer.begin() + begin);
+					}
+				});
+				values.swap(buffer);
+			}
+		}
+
+		// Worker threads kept alive between parallel calls and fed from one queue
+		class TaskPool
+		{
+		private:
+			std::vector<std::thread> workers;
+			std::mutex mutex;
+			std::condition_variable wake;
+			std::deque<std::function<void()>> tasks;
+			bool stopping;
+
+			void Work();
+
+		public:
+			explicit TaskPool(unsigned workerCount);
+			~TaskPool();
+
+			// One worker per core besides the calling thread, started on first use
+			static TaskPool& Shared();
+
+			// Calls f(index, participant) for every index in [0, count) on up to participants threads.
+			// The caller is participant 0 and works too, so a task may itself call Run. Indices are
+			// handed out one at a time, so uneven tasks balance out. Returns once every call has finished.
+			template<typename F>
+			void Run(size_t count, unsigned participants, F f);
+		};
+
+		inline TaskPool::TaskPool(unsigned workerCount) : stopping(false)
+		{
+			for (unsigned i = 0; i < workerCount; i++)
+				workers.emplace_back([this]() { Work(); });
+		}
+
+		inline TaskPool::~TaskPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+
+			wake.notify_all();
+			for (std::thread& worker : workers)
+				worker.join();
+		}
+
+		inline TaskPool& TaskPool::Shared()
+		{
+			static TaskPool pool(ThreadCount(0) - 1);
+			return pool;
+		}
+
+		inline void TaskPool::Work()
+		{
+			while (true)
+			{
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+					if (tasks.empty())
+						return;
+
+					task = std::move(tasks.front());
+					tasks.pop_front();
+				}
+
+				task();
+			}
+		}
+
+		template<typename F>
+		void TaskPool::Run(size_t count, unsigned participants, F f)
+		{
+			if (count == 0)
+				return;
+
+			// Shared with the queued helpers, which may only start after the work is done
+			struct Progress
+			{
+				std::atomic<size_t> next;
+				std::atomic<size_t> done;
+				std::mutex mutex;
+				std::condition_variable finished;
+			};
+
+			std::shared_ptr<Progress> progress = std::make_shared<Progress>();
+			progress->next = 0;
+			progress->done = 0;
+			F* body = &f; // Only touched while indices remain, so late helpers never see it dangling
+			auto work = [progress, body, count](unsigned participant)
+			{
+				size_t index;
+				while ((index = progress->next.fetch_add(1)) < count)
+				{
+					(*body)(index, participant);
+					if (progress->done.fetch_add(1) + 1 == count)
+					{
+						std::lock_guard<std::mutex> lock(progress->mutex);
+						progress->finished.notify_all();
+					}
+				}
+			};
+
+			size_t helpers = std::min<size_t>(std::min<size_t>(participants > 0 ? participants - 1 : 0, workers.size()), count - 1);
+			if (helpers > 0)
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					for (unsigned participant = 1; participant <= helpers; participant++)
+						tasks.push_back([work, participant]() { work(participant); });
+				}
+
+				wake.notify_all();
+			}
+
+			work(0);
+			std::unique_lock<std::mutex> lock(progress->mutex);
+			progress->finished.wait(lock, [&progress, count]() { return progress->done == count; });
+		}
+	}
+}
+
+#endif
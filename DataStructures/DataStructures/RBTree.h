@@ -1,7 +1,13 @@
 #ifndef RED_BLACK_TREE_H
 #define RED_BLACK_TREE_H
 #include <algorithm>
-#include <queue>
+#include <chrono>
+#include <future>
+#include <vector>
+#include "NodeReclaimer.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include "TreeUtils.h"
 
 namespace myDataStructures
 {
@@ -17,11 +23,16 @@ namespace myDataStructures
 		struct Node
 		{
 			T data;
-			unsigned char color;
+			// Copies of data, above 1 only in multiset mode. The color takes the top bit of the
+			// same word, so a node of an int tree stays at 32 bytes with the count in it.
+			unsigned int count : 31;
+			unsigned int color : 1;
 			Node<T> *left, *right, *parent;
 
+			static const unsigned int MaxCount = 0x7FFFFFFF; // Largest count the field holds, further copies are not counted
+
 			explicit Node(T data) 
-				: data(data), color(Color::RED), left(nullptr), right(nullptr), parent(nullptr)
+				: data(data), count(1), color(Color::RED), left(nullptr), right(nullptr), parent(nullptr)
 			{
 			}
 
@@ -60,58 +71,216 @@ namespace myDataStructures
 			}
 		};
 
+		// Subtree aggregate kept in the node data, such as the max endpoint of an interval tree.
+		// Specialize it for a value type to have Update called bottom up whenever a subtree changes.
+		template<typename T>
+		struct NodeAugmentation
+		{
+			static const bool Enabled = false;
+			static void Update(Node<T>*) {}
+		};
+
 		template<typename T>
 		class RBTree
 		{
-		private:
+		protected:
 			Node<T>* root;
+		private:
+			Node<T>* finger; // Last inserted node, where InsertNearFinger starts looking
+			Node<T>* fingerLower; // In order neighbours of the finger, nullptr past either end
+			Node<T>* fingerUpper;
+			Node<T>* leftmost; // Cached extremes, nullptr only when the tree is empty
+			Node<T>* rightmost;
+			mutable size_t size;
+			bool multiset;
+			bool backgroundFree;
+			std::vector<Node<T>*> levelBuffer; // Reused by every level order walk, so it only allocates while it grows
+			mutable std::vector<std::future<size_t>> detachedCounts; // Nodes freed by background erases, taken off size once known
 		protected:
 			void LeftRotation(Node<T>* &n);
 			void RightRotation(Node<T>* &n);
 			void SetColor(Node<T>* &n, unsigned char newColor);
 			void SwapValues(Node<T>* &u, Node<T>* &v);
-			void FixInsertRBTree(Node<T>* &n);
-			void InOrderBST(Node<T>* &n);
-			void PreOrderBST(Node<T>* &n);
-			void LevelOrder(Node<T>* &n);
+			bool FixInsertRBTree(Node<T>* &n);
 			void FixDoubleBlack(Node<T>* &x);
+			void UpdateAugmentation(Node<T>* n);
+			void UpdateAugmentationToRoot(Node<T>* n);
 			Node<T>* MinValueNode(Node<T>* &n);
 			Node<T>* MaxValueNode(Node<T>* &n);
-			Node<T>* InsertNode(Node<T>* &root, Node<T>* &n);
+			Node<T>* InsertFrom(Node<T>* start, T data, Node<T>* lower, Node<T>* upper);
+			Node<T>* LinkLeaf(Node<T>* parent, T data, Node<T>* lower, Node<T>* upper);
+			Node<T>* ClimbToward(Node<T>* hint, T data, Node<T>* &lower, Node<T>* &upper);
+			Node<T>* InsertNear(Node<T>* hint, T data);
+			Node<T>* Locate(T data);
 			Node<T>* Successor(Node<T>* n);
 			Node<T>* BSTreplace(Node<T>* n);
 			void DeleteNode(Node<T>* &v);
+			void FreeNode(Node<T>* n);
+			void RestoreExtremes();
+			void SettleSize() const;
+			void Split(Node<T>* n, int blackHeight, const T& key, bool equalLeft, Node<T>* &left, int& leftHeight, Node<T>* &right, int& rightHeight);
+			Node<T>* Join(Node<T>* left, int leftHeight, Node<T>* pivot, Node<T>* right, int rightHeight, int& blackHeight);
+			Node<T>* Join(Node<T>* left, int leftHeight, Node<T>* right, int rightHeight, int& blackHeight);
+			void ReleaseDetached(Node<T>* n, bool deferFree);
 			unsigned char GetColor(Node<T>* &n) const;
 			int GetBlackHeight(Node<T>* node);
-
+			static size_t RedDepth(size_t count);
+			Node<T>* BuildBalanced(std::vector<Node<T>*>& nodes, size_t lo, size_t hi, size_t depth, size_t redDepth, Node<T>* parent);
+			Node<T>* BuildBalancedParallel(std::vector<Node<T>*>& nodes, size_t lo, size_t hi, size_t depth, size_t redDepth, Node<T>* parent, unsigned splits);
+			Node<T>* CloneSubtree(const Node<T>* n, Node<T>* parent, size_t& nodes) const;
+			Node<T>* CloneSubtreeParallel(const Node<T>* n, Node<T>* parent, unsigned splits, size_t& nodes) const;
+			void Clear(Node<T>* n);
+
+			template<typename F>
+			void ForEachNodeInOrder(F&& f);
+			template<typename F>
+			void ForEachNodePreOrder(F&& f);
+			template<typename F>
+			void ForEachNodeLevelOrder(F&& f);
+			void CollectChunks(std::vector<TreeUtils::SubtreeChunk<Node<T>>>& chunks, unsigned threads);
+			void CollectChunks(Node<T>* n, int blackHeight, int cutoff, std::vector<TreeUtils::SubtreeChunk<Node<T>>>& chunks);
 
 		public:
-			RBTree();
+			// In multiset mode a repeated value raises the count of its node instead of being dropped
+			explicit RBTree(bool multiset = false);
+			// Copies duplicate the shape node by node, keeping every color, so nothing is re-inserted
+			// or recolored. Moves only hand over the root and leave the source empty.
+			RBTree(const RBTree& other);
+			RBTree(RBTree&& other) noexcept;
+			RBTree& operator=(const RBTree& other);
+			RBTree& operator=(RBTree&& other) noexcept;
+			~RBTree();
+
+			// Same as the copy constructor, with the subtrees below the top levels cloned on separate threads.
+			// Pass 0 threads to use the hardware concurrency.
+			RBTree CloneParallel(unsigned threads = 0) const;
+
+			// With background freeing on, dropping the nodes in the destructor, Clear and assignments only
+			// hands the root to the NodeReclaimer thread, so even a huge tree goes away in O(1)
+			void SetBackgroundFree(bool backgroundFree);
+			// Removes every value
+			void Clear();
 			void InsertValue(T data);
+
+			// Inserts next to hint, climbing from it only as far as data requires, so a key that
+			// belongs d positions away costs O(log d). Returns the node holding data.
+			Node<T>* InsertHint(Node<T>* hint, T data);
+			// Uses the last inserted node as the hint, which suits nearly sorted streams
+			Node<T>* InsertNearFinger(T data);
 			void DeleteValue(T data);
+
+			// Remove every value in [lo, hi), below key or above key. The range is cut out by splitting
+			// and joining along O(log n) nodes instead of deleting one value at a time. With deferFree the
+			// detached nodes are freed on a background thread, so the call costs the same however many
+			// values go. Size() then waits for the frees still running to report how many nodes they took.
+			void EraseRange(T lo, T hi, bool deferFree = false);
+			void EraseBelow(T key, bool deferFree = false);
+			void EraseAbove(T key, bool deferFree = false);
 			void InOrder();
 			void PreOrder();
 			void LevelOrder();
 			Node<T>* Search(T data);
+
+			// Smallest and largest nodes in O(1), nullptr when the tree is empty
+			Node<T>* Min() const;
+			Node<T>* Max() const;
+			// Take the smallest or largest value out, one copy at a time in multiset mode.
+			// The new extreme is the neighbour of the removed node, so it is found without a walk,
+			// and removing an extreme needs O(1) rotations amortized.
+			// Return false when the tree is empty.
+			bool PopMin(T& data);
+			bool PopMax(T& data);
+
+			// Looks up many values with their misses overlapped. Unlike Search, results[i] is the
+			// node holding keys[i] or nullptr when it is missing.
+			void SearchBatch(const std::vector<T>& keys, std::vector<Node<T>*>& results);
+			// Distinct values, each node counts once. Blocks while deferred erases are still being freed,
+			// nothing else in the tree waits for them.
+			size_t Size() const;
+
+			// Copies of data, which stops growing at Node<T>::MaxCount (2^31 - 1)
+			unsigned int Count(T data);
+			bool EraseOne(T data);
+			unsigned int EraseAll(T data);
+
+			// Inserts a range of values at once. Large batches are merged with the existing
+			// nodes in one in order pass and the tree is rebuilt, small ones are inserted in value order.
+			template<typename It>
+			void InsertBatch(It first, It last);
+
+			// Adds a large unsorted range using every core: a parallel sort, the new nodes allocated
+			// on every thread and subtrees linked concurrently.
+			// Pass 0 threads to use the hardware concurrency.
+			template<typename It>
+			void BuildParallel(It first, It last, unsigned threads = 0);
+
+			// Visitors receive each value and may return false to stop the walk early.
+			// In order and pre order walks follow the parent pointers, so they need no stack.
+			template<typename F>
+			void ForEachInOrder(F&& f);
+			template<typename F>
+			void ForEachPreOrder(F&& f);
+			template<typename F>
+			void ForEachLevelOrder(F&& f);
+			// Visits each distinct value in order together with its count
+			template<typename F>
+			void ForEachWithCount(F&& f);
+
+			// Parallel walks over every value on the shared task pool, with the tree cut into whole subtrees sized by black height.
+			// f and op run on several threads at once, and the tree must not change meanwhile.
+			// Pass 0 threads to use the hardware concurrency.
+			template<typename F>
+			void ParallelForEach(F&& f, unsigned threads = 0);
+			// op folds a value into a partial result and merges two partial results, as with std::reduce.
+			// Partials merge in any order, so op must be commutative as well as associative.
+			template<typename R, typename Op>
+			R ParallelReduce(R identity, Op op, unsigned threads = 0);
+			// Merges the partials in order, for ops that are associative but not commutative
+			template<typename R, typename Op>
+			R ParallelReduceOrdered(R identity, Op op, unsigned threads = 0);
 		};
 
 		// Public Member Functions Implementations
 		template<typename T>
 		void RBTree<T>::InsertValue(T data)
 		{
-			Node<T>* newNode = new Node<T>(data);
-			root = InsertNode(root, newNode);
-			FixInsertRBTree(newNode);
+			MYDS_TRACE(RBTree, Insert, data);
+			InsertFrom(root, data, nullptr, nullptr);
+		}
+
+		template<typename T>
+		Node<T>* RBTree<T>::InsertHint(Node<T>* hint, T data)
+		{
+			MYDS_TRACE(RBTree, Insert, data);
+			return InsertNear(hint, data);
+		}
+
+		template<typename T>
+		Node<T>* RBTree<T>::InsertNearFinger(T data)
+		{
+			MYDS_TRACE(RBTree, Insert, data);
+			if (finger == nullptr)
+				return InsertFrom(root, data, nullptr, nullptr);
+
+			// Right between the finger and one of its neighbours, the free child slot is known without searching
+			if (finger->data < data && (fingerUpper == nullptr || data < fingerUpper->data))
+				return LinkLeaf(finger->right == nullptr ? finger : fingerUpper, data, finger, fingerUpper);
+
+			if (data < finger->data && (fingerLower == nullptr || fingerLower->data < data))
+				return LinkLeaf(finger->left == nullptr ? finger : fingerLower, data, fingerLower, finger);
+
+			return InsertNear(finger, data);
 		}
 
 		template<typename T>
 		void RBTree<T>::DeleteValue(T data)
 		{
+			MYDS_TRACE(RBTree, Delete, data);
 			if (root == nullptr)
 				// Tree is empty 
 				return;
 
-			Node<T>* v = Search(data);
+			Node<T>* v = Locate(data);
 
 			if (v->data != data) {
 				std::cout << "No node found to delete with value:" << data << std::endl;
@@ -119,6 +288,51 @@ namespace myDataStructures
 			}
 
 			DeleteNode(v);
+			size--;
+			RestoreExtremes();
+		}
+
+		template<typename T>
+		unsigned int RBTree<T>::Count(T data)
+		{
+			Node<T>* n = Locate(data);
+			return n != nullptr && n->data == data ? n->count : 0;
+		}
+
+		template<typename T>
+		bool RBTree<T>::EraseOne(T data)
+		{
+			Node<T>* n = Locate(data);
+			if (n != nullptr && n->data == data && n->count > 1)
+			{
+				MYDS_TRACE(RBTree, EraseOne, data);
+				n->count--;
+				return true;
+			}
+
+			MYDS_TRACE(RBTree, Delete, data);
+			if (n == nullptr || n->data != data)
+				return false;
+
+			DeleteNode(n);
+			size--;
+			RestoreExtremes();
+			return true;
+		}
+
+		template<typename T>
+		unsigned int RBTree<T>::EraseAll(T data)
+		{
+			MYDS_TRACE(RBTree, Delete, data);
+			Node<T>* n = Locate(data);
+			if (n == nullptr || n->data != data)
+				return 0;
+
+			unsigned int count = n->count;
+			DeleteNode(n);
+			size--;
+			RestoreExtremes();
+			return count;
 		}
 
 		template<typename T>
@@ -131,7 +345,7 @@ namespace myDataStructures
 			}
 
 			std::cout << "In Order:" << std::endl;
-			InOrderBST(root);
+			ForEachInOrder([](const T& data) { std::cout << data << " "; });
 			std::cout << '\n';
 		}
 
@@ -145,7 +359,7 @@ namespace myDataStructures
 			}
 
 			std::cout << "Pre Order:" << std::endl;
-			PreOrderBST(root);
+			ForEachNodePreOrder([](Node<T>* n) { std::cout << n->data << " " << static_cast<int>(n->color) << " | " << std::endl; });
 			std::cout << '\n';
 		}
 
@@ -159,12 +373,20 @@ namespace myDataStructures
 			}
 				
 			std::cout << "Level Order:" << std::endl;
-			LevelOrder(root);
+			ForEachLevelOrder([](const T& data) { std::cout << data << " "; });
 			std::cout << '\n';
 		}
 
 		template<typename T>
 		Node<T>* RBTree<T>::Search(T data)
+		{
+			MYDS_TRACE(RBTree, Search, data);
+			return Locate(data);
+		}
+
+		template<typename T>
+		// the node holding data, or the last node on its search path when there is none
+		Node<T>* RBTree<T>::Locate(T data)
 		{
 			Node<T> *temp = root;
 			while (temp != nullptr) {
@@ -188,11 +410,376 @@ namespace myDataStructures
 			return temp;
 		}
 
+		template<typename T>
+		Node<T>* RBTree<T>::Min() const
+		{
+			return leftmost;
+		}
+
+		template<typename T>
+		Node<T>* RBTree<T>::Max() const
+		{
+			return rightmost;
+		}
+
+		template<typename T>
+		bool RBTree<T>::PopMin(T& data)
+		{
+			if (leftmost == nullptr)
+				return false;
+
+			Node<T>* v = leftmost;
+			data = v->data;
+			if (v->count > 1)
+			{
+				MYDS_TRACE(RBTree, EraseOne, data);
+				v->count--;
+				return true;
+			}
+
+			MYDS_TRACE(RBTree, Delete, data);
+
+			// A right child of the minimum is a red leaf that takes its place, or takes over its
+			// value when the minimum is the root. Otherwise the parent is next. Rotations keep these nodes.
+			Node<T>* next = v->right != nullptr ? (v == root ? v : v->right) : v->parent;
+			DeleteNode(v);
+			size--;
+			leftmost = next;
+			RestoreExtremes();
+			return true;
+		}
+
+		template<typename T>
+		bool RBTree<T>::PopMax(T& data)
+		{
+			if (rightmost == nullptr)
+				return false;
+
+			Node<T>* v = rightmost;
+			data = v->data;
+			if (v->count > 1)
+			{
+				MYDS_TRACE(RBTree, EraseOne, data);
+				v->count--;
+				return true;
+			}
+
+			MYDS_TRACE(RBTree, Delete, data);
+
+			Node<T>* next = v->left != nullptr ? (v == root ? v : v->left) : v->parent;
+			DeleteNode(v);
+			size--;
+			rightmost = next;
+			RestoreExtremes();
+			return true;
+		}
+
+		template<typename T>
+		void RBTree<T>::SearchBatch(const std::vector<T>& keys, std::vector<Node<T>*>& results)
+		{
+			TreeUtils::InterleavedSearch(root, keys, results, [](Node<T>* n) -> const T& { return n->data; });
+		}
+
+		template<typename T>
+		size_t RBTree<T>::Size() const
+		{
+			SettleSize();
+			return size;
+		}
+
+		template<typename T>
+		void RBTree<T>::EraseRange(T lo, T hi, bool deferFree)
+		{
+			if (root == nullptr || !(lo < hi))
+				return;
+
+			Node<T> *below, *rest, *range, *above;
+			int belowHeight, restHeight, rangeHeight, aboveHeight, height;
+			Split(root, GetBlackHeight(root), lo, false, below, belowHeight, rest, restHeight);
+			Split(rest, restHeight, hi, false, range, rangeHeight, above, aboveHeight);
+			root = Join(below, belowHeight, above, aboveHeight, height);
+			ReleaseDetached(range, deferFree);
+		}
+
+		template<typename T>
+		void RBTree<T>::EraseBelow(T key, bool deferFree)
+		{
+			if (root == nullptr)
+				return;
+
+			Node<T> *below, *rest;
+			int belowHeight, restHeight;
+			Split(root, GetBlackHeight(root), key, false, below, belowHeight, rest, restHeight);
+			root = rest;
+			ReleaseDetached(below, deferFree);
+		}
+
+		template<typename T>
+		void RBTree<T>::EraseAbove(T key, bool deferFree)
+		{
+			if (root == nullptr)
+				return;
+
+			Node<T> *rest, *above;
+			int restHeight, aboveHeight;
+			Split(root, GetBlackHeight(root), key, true, rest, restHeight, above, aboveHeight);
+			root = rest;
+			ReleaseDetached(above, deferFree);
+		}
+
+		template<typename T>
+		template<typename It>
+		void RBTree<T>::InsertBatch(It first, It last)
+		{
+			std::vector<T> batch(first, last);
+			MYDS_TRACE_EACH(RBTree, Insert, batch.begin(), batch.end());
+			std::vector<unsigned> counts;
+			std::vector<unsigned>* batchCounts = multiset ? &counts : nullptr;
+			TreeUtils::PrepareBatch(batch, batchCounts, 1);
+			if (batch.empty())
+				return;
+
+			if (TreeUtils::DescentsCheaper(batch.size(), size)) // size may still count nodes being freed, close enough here
+			{
+				for (size_t i = 0; i < batch.size(); i++)
+				{
+					Node<T>* n = InsertFrom(root, batch[i], nullptr, nullptr);
+					if (multiset)
+						TreeUtils::AddCopies(n, counts[i] - 1);
+				}
+				return;
+			}
+
+			std::vector<Node<T>*> nodes;
+			nodes.reserve(size + batch.size());
+			TreeUtils::MergeBatch(root, batch, batchCounts, [](Node<T>* n) -> const T& { return n->data; }, nodes);
+
+			size = nodes.size();
+			detachedCounts.clear(); // The walk above counted what is left, erases still being freed are settled
+			finger = nullptr;
+			root = BuildBalanced(nodes, 0, nodes.size(), 0, RedDepth(nodes.size()), nullptr);
+			leftmost = nodes.front();
+			rightmost = nodes.back();
+		}
+
+		template<typename T>
+		template<typename It>
+		void RBTree<T>::BuildParallel(It first, It last, unsigned threads)
+		{
+			threads = Parallel::ThreadCount(threads);
+			std::vector<T> batch(first, last);
+			MYDS_TRACE_EACH(RBTree, Insert, batch.begin(), batch.end());
+			std::vector<unsigned> counts;
+			std::vector<unsigned>* batchCounts = multiset ? &counts : nullptr;
+			TreeUtils::PrepareBatch(batch, batchCounts, threads);
+
+			std::vector<Node<T>*> nodes;
+			TreeUtils::MergeBatchParallel(root, size, batch, batchCounts, threads, [](Node<T>* n) -> const T& { return n->data; }, nodes);
+
+			size = nodes.size();
+			detachedCounts.clear();
+			finger = nullptr;
+			root = BuildBalancedParallel(nodes, 0, nodes.size(), 0, RedDepth(nodes.size()), nullptr, Parallel::SplitDepth(threads));
+			leftmost = rightmost = nullptr;
+			RestoreExtremes();
+		}
+
+		template<typename T>
+		// cuts the tree into about eight chunks per thread, in value order
+		void RBTree<T>::CollectChunks(std::vector<TreeUtils::SubtreeChunk<Node<T>>>& chunks, unsigned threads)
+		{
+			int depth = static_cast<int>(Parallel::SplitDepth(Parallel::ThreadCount(threads) * 8));
+			if (size < 4096 || Parallel::ThreadCount(threads) == 1) // size, not Size(), which waits for deferred erases
+				depth = 0;
+
+			int blackHeight = GetBlackHeight(root);
+			CollectChunks(root, blackHeight, blackHeight - depth, chunks);
+		}
+
+		template<typename T>
+		// subtrees whose black height is at most cutoff become one chunk, the nodes above them a chunk each.
+		// A subtree of black height b holds between 2^b and 4^b nodes, so one chunk may be up to 2^b times
+		// another. The task pool hands the chunks out one at a time, which is what evens out the threads.
+		void RBTree<T>::CollectChunks(Node<T>* n, int blackHeight, int cutoff, std::vector<TreeUtils::SubtreeChunk<Node<T>>>& chunks)
+		{
+			if (n == nullptr)
+				return;
+
+			if (blackHeight <= cutoff)
+			{
+				chunks.push_back({ n, true });
+				return;
+			}
+
+			int childHeight = blackHeight - (n->color == Color::BLACK ? 1 : 0);
+			CollectChunks(n->left, childHeight, cutoff, chunks);
+			chunks.push_back({ n, false });
+			CollectChunks(n->right, childHeight, cutoff, chunks);
+		}
+
+		template<typename T>
+		template<typename F>
+		void RBTree<T>::ParallelForEach(F&& f, unsigned threads)
+		{
+			std::vector<TreeUtils::SubtreeChunk<Node<T>>> chunks;
+			CollectChunks(chunks, threads);
+			TreeUtils::ParallelForEachChunk(chunks, threads, f, [](Node<T>* n) -> const T& { return n->data; });
+		}
+
+		template<typename T>
+		template<typename R, typename Op>
+		R RBTree<T>::ParallelReduce(R identity, Op op, unsigned threads)
+		{
+			std::vector<TreeUtils::SubtreeChunk<Node<T>>> chunks;
+			CollectChunks(chunks, threads);
+			return TreeUtils::ParallelReduceChunks(chunks, threads, identity, op, [](Node<T>* n) -> const T& { return n->data; }, false);
+		}
+
+		template<typename T>
+		template<typename R, typename Op>
+		R RBTree<T>::ParallelReduceOrdered(R identity, Op op, unsigned threads)
+		{
+			std::vector<TreeUtils::SubtreeChunk<Node<T>>> chunks;
+			CollectChunks(chunks, threads);
+			return TreeUtils::ParallelReduceChunks(chunks, threads, identity, op, [](Node<T>* n) -> const T& { return n->data; }, true);
+		}
+
+		template<typename T>
+		template<typename F>
+		void RBTree<T>::ForEachWithCount(F&& f)
+		{
+			ForEachNodeInOrder([&f](Node<T>* n) { return TreeUtils::Visit(f, static_cast<const T&>(n->data), static_cast<unsigned int>(n->count)); });
+		}
+
+		template<typename T>
+		template<typename F>
+		void RBTree<T>::ForEachInOrder(F&& f)
+		{
+			ForEachNodeInOrder([&f](Node<T>* n) { return TreeUtils::Visit(f, static_cast<const T&>(n->data)); });
+		}
+
+		template<typename T>
+		template<typename F>
+		void RBTree<T>::ForEachPreOrder(F&& f)
+		{
+			ForEachNodePreOrder([&f](Node<T>* n) { return TreeUtils::Visit(f, static_cast<const T&>(n->data)); });
+		}
+
+		template<typename T>
+		template<typename F>
+		void RBTree<T>::ForEachLevelOrder(F&& f)
+		{
+			ForEachNodeLevelOrder([&f](Node<T>* n) { return TreeUtils::Visit(f, static_cast<const T&>(n->data)); });
+		}
+
 		// Default Constructor 
 		template<typename T>
-		RBTree<T>::RBTree() 
-			: root(nullptr)
+		RBTree<T>::RBTree(bool multiset) 
+			: root(nullptr), finger(nullptr), fingerLower(nullptr), fingerUpper(nullptr), leftmost(nullptr), rightmost(nullptr), size(0), multiset(multiset),
+			backgroundFree(false)
+		{
+		}
+
+		template<typename T>
+		RBTree<T>::RBTree(const RBTree& other)
+			: root(nullptr), finger(nullptr), fingerLower(nullptr), fingerUpper(nullptr),
+			leftmost(nullptr), rightmost(nullptr), size(0), multiset(other.multiset), backgroundFree(other.backgroundFree)
+		{
+			root = CloneSubtree(other.root, nullptr, size);
+			RestoreExtremes();
+		}
+
+		template<typename T>
+		RBTree<T>::RBTree(RBTree&& other) noexcept
+			: root(other.root), finger(other.finger), fingerLower(other.fingerLower), fingerUpper(other.fingerUpper),
+			leftmost(other.leftmost), rightmost(other.rightmost), size(other.size), multiset(other.multiset),
+			backgroundFree(other.backgroundFree), levelBuffer(std::move(other.levelBuffer)), detachedCounts(std::move(other.detachedCounts))
+		{
+			other.root = nullptr;
+			other.finger = nullptr;
+			other.leftmost = other.rightmost = nullptr;
+			other.size = 0;
+		}
+
+		template<typename T>
+		RBTree<T>& RBTree<T>::operator=(const RBTree& other)
+		{
+			if (this != &other)
+			{
+				size_t nodes = 0;
+				Node<T>* copy = CloneSubtree(other.root, nullptr, nodes);
+				Clear(root);
+				root = copy;
+				finger = nullptr;
+				leftmost = rightmost = nullptr;
+				size = nodes;
+				multiset = other.multiset;
+				backgroundFree = other.backgroundFree;
+				detachedCounts.clear();
+				RestoreExtremes();
+			}
+
+			return *this;
+		}
+
+		template<typename T>
+		RBTree<T>& RBTree<T>::operator=(RBTree&& other) noexcept
 		{
+			if (this != &other)
+			{
+				Clear(root);
+				root = other.root;
+				finger = other.finger;
+				fingerLower = other.fingerLower;
+				fingerUpper = other.fingerUpper;
+				leftmost = other.leftmost;
+				rightmost = other.rightmost;
+				size = other.size;
+				multiset = other.multiset;
+				backgroundFree = other.backgroundFree;
+				levelBuffer = std::move(other.levelBuffer);
+				detachedCounts = std::move(other.detachedCounts);
+				other.root = nullptr;
+				other.finger = nullptr;
+				other.leftmost = other.rightmost = nullptr;
+				other.size = 0;
+			}
+
+			return *this;
+		}
+
+		template<typename T>
+		RBTree<T>::~RBTree()
+		{
+			Clear(root);
+		}
+
+		template<typename T>
+		RBTree<T> RBTree<T>::CloneParallel(unsigned threads) const
+		{
+			RBTree<T> copy(multiset);
+			unsigned splits = size < 8192 ? 0 : Parallel::SplitDepth(Parallel::ThreadCount(threads));
+			copy.root = CloneSubtreeParallel(root, nullptr, splits, copy.size);
+			copy.backgroundFree = backgroundFree;
+			copy.RestoreExtremes();
+			return copy;
+		}
+
+		template<typename T>
+		void RBTree<T>::SetBackgroundFree(bool backgroundFree)
+		{
+			this->backgroundFree = backgroundFree;
+		}
+
+		template<typename T>
+		void RBTree<T>::Clear()
+		{
+			Clear(root);
+			root = nullptr;
+			finger = fingerLower = fingerUpper = nullptr;
+			leftmost = rightmost = nullptr;
+			size = 0;
+			detachedCounts.clear(); // Erases still being freed no longer change the size
 		}
 
 		// Protected Member Functions Implementations
@@ -217,6 +804,9 @@ namespace myDataStructures
 			rightChild->left = n;
 			rightChild->parent = n->parent;
 			n->parent = rightChild;
+
+			UpdateAugmentation(n);
+			UpdateAugmentation(rightChild);
 		}
 
 
@@ -239,6 +829,9 @@ namespace myDataStructures
 			leftChild->right = n;
 			leftChild->parent = n->parent;
 			n->parent = leftChild;
+
+			UpdateAugmentation(n);
+			UpdateAugmentation(leftChild);
 		}
 
 		template<typename T>
@@ -253,9 +846,10 @@ namespace myDataStructures
 		template<typename T>
 		void RBTree<T>::SwapValues(Node<T>* &u, Node<T>* &v)
 		{
-			T temp = u->data;
-			u->data = v->data;
-			v->data = temp;
+			std::swap(u->data, v->data);
+			unsigned int count = u->count; // Bit-fields cannot bind to std::swap
+			u->count = v->count;
+			v->count = count;
 		}
 
 		template<typename T>
@@ -281,23 +875,118 @@ namespace myDataStructures
 		}
 
 		template<typename T>
-		Node<T>* RBTree<T>::InsertNode(Node<T>*& root, Node<T>*& n)
+		// descends from start, which must be the root or a node whose subtree range holds data,
+		// lower and upper are the nodes bounding that range
+		Node<T>* RBTree<T>::InsertFrom(Node<T>* start, T data, Node<T>* lower, Node<T>* upper)
 		{
-			if (root == nullptr)
-				return n;
+			Node<T>* parent = nullptr;
+			Node<T>* current = start;
+			while (current != nullptr)
+			{
+				parent = current;
+				if (data < current->data)
+				{
+					upper = current;
+					current = current->left;
+				}
+				else if (current->data < data)
+				{
+					lower = current;
+					current = current->right;
+				}
+				else
+				{
+					// Already present
+					if (multiset)
+						TreeUtils::AddCopies(current, 1);
+					return current;
+				}
+			}
 
-			if (n->data > root->data)
+			return LinkLeaf(parent, data, lower, upper);
+		}
+
+		template<typename T>
+		// hangs a new node holding data under parent and makes it the finger
+		Node<T>* RBTree<T>::LinkLeaf(Node<T>* parent, T data, Node<T>* lower, Node<T>* upper)
+		{
+			Node<T>* newNode = new Node<T>(data);
+			newNode->parent = parent;
+			if (parent == nullptr)
+				root = newNode;
+			else if (data < parent->data)
+				parent->left = newNode;
+			else
+				parent->right = newNode;
+
+			size++;
+			if (leftmost == nullptr || data < leftmost->data)
+				leftmost = newNode;
+			if (rightmost == nullptr || rightmost->data < data)
+				rightmost = newNode;
+
+			finger = newNode;
+			fingerLower = lower;
+			fingerUpper = upper;
+			UpdateAugmentationToRoot(newNode);
+
+			Node<T>* n = newNode;
+			FixInsertRBTree(n);
+			return newNode;
+		}
+
+		template<typename T>
+		// climbs from hint to the lowest ancestor whose subtree range holds data
+		// and reports the ancestor bounding that range on the side it climbed toward
+		Node<T>* RBTree<T>::ClimbToward(Node<T>* hint, T data, Node<T>* &lower, Node<T>* &upper)
+		{
+			Node<T>* n = hint;
+			if (hint->data < data)
 			{
-				root->right = InsertNode(root->right, n);
-				root->right->parent = root;
+				// Ancestors reached from a right child are smaller than hint, so only the others bound data
+				while (n->parent != nullptr)
+				{
+					if (n == n->parent->left && data < n->parent->data)
+					{
+						upper = n->parent;
+						break;
+					}
+
+					n = n->parent;
+					if (!(n->data < data))
+						break; // Equal, InsertFrom finds it right away
+				}
 			}
-			else if (n->data < root->data)
+			else if (data < hint->data)
 			{
-				root->left = InsertNode(root->left, n);
-				root->left->parent = root;
+				while (n->parent != nullptr)
+				{
+					if (n == n->parent->right && n->parent->data < data)
+					{
+						lower = n->parent;
+						break;
+					}
+
+					n = n->parent;
+					if (!(data < n->data))
+						break;
+				}
 			}
 
-			return root;
+			return n;
+		}
+
+		template<typename T>
+		// the insert behind InsertHint and InsertNearFinger, climbing from hint instead of descending from the root
+		Node<T>* RBTree<T>::InsertNear(Node<T>* hint, T data)
+		{
+			if (hint == nullptr)
+				return InsertFrom(root, data, nullptr, nullptr);
+
+			Node<T>* lower = nullptr;
+			Node<T>* upper = nullptr;
+			Node<T>* start = ClimbToward(hint, data, lower, upper);
+			return InsertFrom(start, data, lower, upper);
 		}
 
 		template<typename T>
@@ -337,6 +1026,9 @@ namespace myDataStructures
 		// deletes the given node 
 		void RBTree<T>::DeleteNode(Node<T>* &v)
 		{
+			// Values move between nodes below, so the finger neighbours are no longer reliable
+			finger = nullptr;
+
 			Node<T>* u = BSTreplace(v);
 			// True when u and v are both black
 			bool uvBlack = (GetColor(u) == Color::BLACK) && (GetColor(v) == Color::BLACK);
@@ -373,9 +1065,11 @@ namespace myDataStructures
 						parent->left = nullptr;
 					else
 						parent->right = nullptr;
+
+					UpdateAugmentationToRoot(parent);
 				}
 
-				delete (v);
+				FreeNode(v);
 				return;
 			}
 
@@ -386,8 +1080,10 @@ namespace myDataStructures
 				{
 					// v is root, assign the value of u to v, and delete u
 					v->data = u->data;
+					v->count = u->count;
 					v->left = v->right = nullptr;
-					delete (u);
+					FreeNode(u);
+					UpdateAugmentation(v);
 				}
 				else
 				{
@@ -401,8 +1097,9 @@ namespace myDataStructures
 						parent->right = u;
 					}
 
-					delete (v);
+					FreeNode(v);
 					u->parent = parent;
+					UpdateAugmentationToRoot(parent);
 
 					if (uvBlack)
 					{
@@ -420,9 +1117,223 @@ namespace myDataStructures
 
 			// v has 2 children , swap values with successor and recurse
 			SwapValues(u, v);
+			UpdateAugmentationToRoot(u);
 			DeleteNode(u);
 		}
 
+		template<typename T>
+		// deletes a node unlinked by DeleteNode, dropping it from the cached extremes
+		void RBTree<T>::FreeNode(Node<T>* n)
+		{
+			if (n == leftmost)
+				leftmost = nullptr;
+			if (n == rightmost)
+				rightmost = nullptr;
+
+			delete n;
+		}
+
+		template<typename T>
+		// walks down again to whichever extreme a deletion dropped
+		void RBTree<T>::RestoreExtremes()
+		{
+			if (root == nullptr)
+			{
+				leftmost = rightmost = nullptr;
+				return;
+			}
+
+			if (leftmost == nullptr)
+				leftmost = MinValueNode(root);
+			if (rightmost == nullptr)
+				rightmost = MaxValueNode(root);
+		}
+
+		template<typename T>
+		void RBTree<T>::SettleSize() const
+		{
+			for (std::future<size_t>& count : detachedCounts)
+				size -= count.get();
+
+			detachedCounts.clear();
+		}
+
+		template<typename T>
+		// splits the subtree under n, whose black height is given, into the values below key and the rest.
+		// With equalLeft a value equal to key goes left. Both parts come out as valid trees with their black heights.
+		void RBTree<T>::Split(Node<T>* n, int blackHeight, const T& key, bool equalLeft, Node<T>* &left, int& leftHeight, Node<T>* &right, int& rightHeight)
+		{
+			if (n == nullptr)
+			{
+				left = right = nullptr;
+				leftHeight = rightHeight = 0;
+				return;
+			}
+
+			Node<T>* l = n->left;
+			Node<T>* r = n->right;
+			if (l != nullptr)
+				l->parent = nullptr;
+			if (r != nullptr)
+				r->parent = nullptr;
+
+			int childHeight = blackHeight - (n->color == Color::BLACK ? 1 : 0);
+			if (n->data < key || (equalLeft && !(key < n->data)))
+			{
+				// n and everything left of it stay below, split what is right of it
+				Node<T>* middle;
+				int middleHeight;
+				Split(r, childHeight, key, equalLeft, middle, middleHeight, right, rightHeight);
+				left = Join(l, childHeight, n, middle, middleHeight, leftHeight);
+			}
+			else
+			{
+				Node<T>* middle;
+				int middleHeight;
+				Split(l, childHeight, key, equalLeft, left, leftHeight, middle, middleHeight);
+				right = Join(middle, middleHeight, n, r, childHeight, rightHeight);
+			}
+		}
+
+		template<typename T>
+		// joins two trees around pivot, every value of left being smaller than pivot and every value of right larger.
+		// The pivot goes down the taller tree's inner spine to where the black heights match, so the cost is
+		// O(1 + the difference of the black heights).
+		Node<T>* RBTree<T>::Join(Node<T>* left, int leftHeight, Node<T>* pivot, Node<T>* right, int rightHeight, int& blackHeight)
+		{
+			// A red root can always be blackened, which makes the spine walk below simpler
+			if (GetColor(left) == Color::RED)
+			{
+				left->color = Color::BLACK;
+				leftHeight++;
+			}
+			if (GetColor(right) == Color::RED)
+			{
+				right->color = Color::BLACK;
+				rightHeight++;
+			}
+
+			if (leftHeight == rightHeight)
+			{
+				pivot->left = left;
+				pivot->right = right;
+				pivot->parent = nullptr;
+				pivot->color = Color::BLACK;
+				if (left != nullptr)
+					left->parent = pivot;
+				if (right != nullptr)
+					right->parent = pivot;
+
+				UpdateAugmentation(pivot);
+				blackHeight = leftHeight + 1;
+				return pivot;
+			}
+
+			// Find the first black node on the taller tree's inner spine at the shorter tree's black height
+			bool leftTaller = leftHeight > rightHeight;
+			Node<T>* tall = leftTaller ? left : right;
+			Node<T>* parent = nullptr;
+			Node<T>* c = tall;
+			int height = leftTaller ? leftHeight : rightHeight;
+			int target = leftTaller ? rightHeight : leftHeight;
+			while (height != target || GetColor(c) != Color::BLACK)
+			{
+				if (GetColor(c) == Color::BLACK)
+					height--;
+
+				parent = c;
+				c = leftTaller ? c->right : c->left;
+			}
+
+			// The red pivot takes c's place with c and the shorter tree below it, keeping every black height
+			pivot->parent = parent;
+			pivot->color = Color::RED;
+			if (leftTaller)
+			{
+				pivot->left = c;
+				pivot->right = right;
+				parent->right = pivot;
+			}
+			else
+			{
+				pivot->left = left;
+				pivot->right = c;
+				parent->left = pivot;
+			}
+
+			if (pivot->left != nullptr)
+				pivot->left->parent = pivot;
+			if (pivot->right != nullptr)
+				pivot->right->parent = pivot;
+
+			UpdateAugmentation(pivot);
+			UpdateAugmentationToRoot(parent);
+
+			// The insert fixup works on root, so point it at the taller tree for the moment
+			Node<T>* saved = root;
+			root = tall;
+			Node<T>* n = pivot;
+			blackHeight = (leftTaller ? leftHeight : rightHeight) + (FixInsertRBTree(n) ? 1 : 0);
+			Node<T>* joined = root;
+			root = saved;
+			return joined;
+		}
+
+		template<typename T>
+		// joins two trees without a pivot, taking the smallest value of right as the pivot
+		Node<T>* RBTree<T>::Join(Node<T>* left, int leftHeight, Node<T>* right, int rightHeight, int& blackHeight)
+		{
+			if (left == nullptr || right == nullptr)
+			{
+				blackHeight = left != nullptr ? leftHeight : rightHeight;
+				return left != nullptr ? left : right;
+			}
+
+			Node<T>* min = MinValueNode(right);
+			Node<T> *pivot, *rest;
+			int pivotHeight, restHeight;
+			Split(right, rightHeight, min->data, true, pivot, pivotHeight, rest, restHeight);
+			return Join(left, leftHeight, pivot, rest, restHeight, blackHeight);
+		}
+
+		template<typename T>
+		// frees a subtree cut out of the tree, here or on a background thread, and brings the cached state up to date
+		void RBTree<T>::ReleaseDetached(Node<T>* n, bool deferFree)
+		{
+			finger = nullptr;
+			leftmost = rightmost = nullptr;
+			RestoreExtremes();
+			if (n == nullptr)
+				return;
+
+#ifdef MYDS_ENABLE_TRACE
+			// The range erases are recorded here, as the values they cut out
+			if (Trace::Recorder::Instance().Recording())
+			{
+				auto record = [&](Node<T>* erased) { MYDS_TRACE(RBTree, Delete, erased->data); };
+				TreeUtils::ForEachNodeInSubtree(n, record);
+			}
+#endif
+
+			if (deferFree)
+			{
+				// Take off the frees that are done, so a tree whose Size() is never asked keeps few futures
+				size_t pending = 0;
+				for (size_t i = 0; i < detachedCounts.size(); i++)
+				{
+					if (detachedCounts[i].wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+						size -= detachedCounts[i].get();
+					else if (pending++ != i)
+						detachedCounts[pending - 1] = std::move(detachedCounts[i]);
+				}
+
+				detachedCounts.resize(pending);
+				detachedCounts.push_back(NodeReclaimer::Reclaimer::Instance().Reclaim(n));
+			}
+			else
+				size -= TreeUtils::FreeSubtree(n);
+		}
+
 		template<typename T>
 		void RBTree<T>::FixDoubleBlack(Node<T>* &x)
 		{
@@ -541,7 +1452,117 @@ namespace myDataStructures
 		}
 
 		template<typename T>
-		void RBTree<T>::FixInsertRBTree(Node<T>* &n)
+		// depth of the last level of a balanced tree of count nodes. The levels above it are full, so only that one is red.
+		size_t RBTree<T>::RedDepth(size_t count)
+		{
+			size_t redDepth = 0;
+			while ((size_t(2) << redDepth) <= count + 1)
+				redDepth++;
+
+			return redDepth;
+		}
+
+		template<typename T>
+		// links the sorted nodes[lo, hi) into a balanced subtree, coloring the incomplete last level red
+		Node<T>* RBTree<T>::BuildBalanced(std::vector<Node<T>*>& nodes, size_t lo, size_t hi, size_t depth, size_t redDepth, Node<T>* parent)
+		{
+			if (lo >= hi)
+				return nullptr;
+
+			size_t mid = lo + (hi - lo) / 2;
+			Node<T>* n = nodes[mid];
+			n->parent = parent;
+			n->color = depth >= redDepth ? Color::RED : Color::BLACK;
+			n->left = BuildBalanced(nodes, lo, mid, depth + 1, redDepth, n);
+			n->right = BuildBalanced(nodes, mid + 1, hi, depth + 1, redDepth, n);
+			UpdateAugmentation(n);
+			return n;
+		}
+
+		template<typename T>
+		// same as BuildBalanced, with the two halves of the top splits levels linked on separate threads
+		Node<T>* RBTree<T>::BuildBalancedParallel(std::vector<Node<T>*>& nodes, size_t lo, size_t hi, size_t depth, size_t redDepth, Node<T>* parent, unsigned splits)
+		{
+			if (splits == 0 || hi - lo < 4096)
+				return BuildBalanced(nodes, lo, hi, depth, redDepth, parent);
+
+			size_t mid = lo + (hi - lo) / 2;
+			Node<T>* n = nodes[mid];
+			n->parent = parent;
+			n->color = depth >= redDepth ? Color::RED : Color::BLACK;
+			Parallel::Invoke(true,
+				[&]() { n->left = BuildBalancedParallel(nodes, lo, mid, depth + 1, redDepth, n, splits - 1); },
+				[&]() { n->right = BuildBalancedParallel(nodes, mid + 1, hi, depth + 1, redDepth, n, splits - 1); });
+			UpdateAugmentation(n);
+			return n;
+		}
+
+		template<typename T>
+		// copies the subtree under n, colors, counts and augmented data included, and adds the nodes copied
+		// to nodes. Counting here keeps copies from waiting on the deferred erases of the source.
+		Node<T>* RBTree<T>::CloneSubtree(const Node<T>* n, Node<T>* parent, size_t& nodes) const
+		{
+			if (n == nullptr)
+				return nullptr;
+
+			nodes++;
+			Node<T>* copy = new Node<T>(n->data);
+			copy->count = n->count;
+			copy->color = n->color;
+			copy->parent = parent;
+			copy->left = CloneSubtree(n->left, copy, nodes);
+			copy->right = CloneSubtree(n->right, copy, nodes);
+			return copy;
+		}
+
+		template<typename T>
+		// same as CloneSubtree, with the two children of the top splits levels cloned on separate threads
+		Node<T>* RBTree<T>::CloneSubtreeParallel(const Node<T>* n, Node<T>* parent, unsigned splits, size_t& nodes) const
+		{
+			if (splits == 0 || n == nullptr)
+				return CloneSubtree(n, parent, nodes);
+
+			size_t leftNodes = 0, rightNodes = 0;
+			Node<T>* copy = new Node<T>(n->data);
+			copy->count = n->count;
+			copy->color = n->color;
+			copy->parent = parent;
+			Parallel::Invoke(true,
+				[&]() { copy->left = CloneSubtreeParallel(n->left, copy, splits - 1, leftNodes); },
+				[&]() { copy->right = CloneSubtreeParallel(n->right, copy, splits - 1, rightNodes); });
+			nodes += 1 + leftNodes + rightNodes;
+			return copy;
+		}
+
+		template<typename T>
+		// frees a subtree the tree no longer links to, without recursion or on the reclaimer
+		void RBTree<T>::Clear(Node<T>* n)
+		{
+			if (backgroundFree)
+				NodeReclaimer::Reclaimer::Instance().Reclaim(n);
+			else
+				TreeUtils::FreeSubtree(n);
+		}
+
+		template<typename T>
+		inline void RBTree<T>::UpdateAugmentation(Node<T>* n)
+		{
+			if (NodeAugmentation<T>::Enabled && n != nullptr)
+				NodeAugmentation<T>::Update(n);
+		}
+
+		template<typename T>
+		void RBTree<T>::UpdateAugmentationToRoot(Node<T>* n)
+		{
+			if (!NodeAugmentation<T>::Enabled)
+				return;
+
+			for (; n != nullptr; n = n->parent)
+				NodeAugmentation<T>::Update(n);
+		}
+
+		template<typename T>
+		bool RBTree<T>::FixInsertRBTree(Node<T>* &n)
 		{
 			Node<T>* parent = nullptr;
 			Node<T>* grandParent = nullptr;
@@ -578,7 +1599,9 @@ namespace myDataStructures
 
 						// Right Rotation
 						RightRotation(grandParent);
-						std::swap(parent->color, grandParent->color);
+						unsigned char parentColor = parent->color;
+						parent->color = grandParent->color;
+						grandParent->color = parentColor;
 						n = parent;
 					}
 
@@ -608,68 +1631,101 @@ namespace myDataStructures
 
 						// Left Rotation
 						LeftRotation(grandParent);
-						std::swap(parent->color, grandParent->color);
+						unsigned char parentColor = parent->color;
+						parent->color = grandParent->color;
+						grandParent->color = parentColor;
 						n = parent;
 					}
 				}
 			}
 
+			// A red root here means the recoloring reached it, so blackening it adds a black level
+			bool grew = GetColor(root) == Color::RED;
 			SetColor(root, Color::BLACK);
+			return grew;
 		}
 
 		template<typename T>
-		void RBTree<T>::InOrderBST(Node<T>*& n)
+		template<typename F>
+		void RBTree<T>::ForEachNodeInOrder(F&& f)
 		{
-			if (n == nullptr)
+			if (root == nullptr)
 				return;
 
-			InOrderBST(n->left);
-			std::cout << n->data << " ";
-			InOrderBST(n->right);
+			Node<T>* n = MinValueNode(root);
+			while (n != nullptr)
+			{
+				if (!TreeUtils::Visit(f, n))
+					return;
+
+				if (n->right != nullptr)
+				{
+					// Successor is the leftmost node of the right subtree
+					n = MinValueNode(n->right);
+				}
+				else
+				{
+					// Climb until we come up from a left child
+					Node<T>* parent = n->parent;
+					while (parent != nullptr && n == parent->right)
+					{
+						n = parent;
+						parent = parent->parent;
+					}
+					n = parent;
+				}
+			}
 		}
 
 		template<typename T>
-		void RBTree<T>::PreOrderBST(Node<T>*& n)
+		template<typename F>
+		void RBTree<T>::ForEachNodePreOrder(F&& f)
 		{
-			if (n == nullptr)
-				return;
+			Node<T>* n = root;
+			while (n != nullptr)
+			{
+				if (!TreeUtils::Visit(f, n))
+					return;
+
+				if (n->left != nullptr)
+				{
+					n = n->left;
+				}
+				else if (n->right != nullptr)
+				{
+					n = n->right;
+				}
+				else
+				{
+					// Climb until we come up from a left child whose parent has a right subtree
+					while (n->parent != nullptr && (n == n->parent->right || n->parent->right == nullptr))
+						n = n->parent;
 
-			std::cout << n->data << " " << n->color << " | " << std::endl;
-			PreOrderBST(n->left);
-			PreOrderBST(n->right);
+					n = n->parent != nullptr ? n->parent->right : nullptr;
+				}
+			}
 		}
 
 		template<typename T>
-		// prints level order for given node 
-		void RBTree<T>::LevelOrder(Node<T>* &n) {
-			if (n == nullptr)
-				// return if node is null 
-				return;
-
-			// queue for level order 
-			std::queue<Node<T>*> q;
-			Node<T>* curr;
-
-			// push n 
-			q.push(n);
-
-			while (!q.empty()) {
-				// while q is not empty 
-				// dequeue 
-				curr = q.front();
-				q.pop();
-
-				// print node value 
-				std::cout << curr->data << " ";
+		template<typename F>
+		void RBTree<T>::ForEachNodeLevelOrder(F&& f)
+		{
+			levelBuffer.clear();
+			if (root != nullptr)
+				levelBuffer.push_back(root);
 
-				// push children to queue 
-				if (curr->left != nullptr)
-					q.push(curr->left);
-				if (curr->right != nullptr)
-					q.push(curr->right);
+			for (size_t i = 0; i < levelBuffer.size(); i++)
+			{
+				Node<T>* n = levelBuffer[i];
+				if (!TreeUtils::Visit(f, n))
+					return;
+
+				if (n->left != nullptr)
+					levelBuffer.push_back(n->left);
+				if (n->right != nullptr)
+					levelBuffer.push_back(n->right);
 			}
 		}
-
 	
 
 		
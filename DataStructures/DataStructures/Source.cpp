@@ -1,6 +1,9 @@
 #include <iostream>
+#include <string>
 #include "AVLTree.h"
 #include "RBTree.h"
+#include "Benchmarks.h"
+#include "TraceReplay.h"
 
 template<typename T>
 using MyAVLTree = myDataStructures::AVLTree::AVLTree<T>;
@@ -9,8 +12,15 @@ template<typename T>
 using MyRBTree = myDataStructures::RBTree::RBTree<T>;
 
 
-int main()
+// DataStructures --replay <trace> [--per-thread] replays a set trace recorded with MYDS_ENABLE_TRACE
+int main(int argc, char* argv[])
 {
+	if (argc >= 3 && std::string(argv[1]) == "--replay")
+	{
+		myDataStructures::TraceReplay::Ordering ordering = argc >= 4 && std::string(argv[3]) == "--per-thread"
+			? myDataStructures::TraceReplay::Ordering::PerThread : myDataStructures::TraceReplay::Ordering::Original;
+		return myDataStructures::TraceReplay::Run(argv[2], ordering);
+	}
 
 	//### Test AVL Tree - BEGIN ###
 	//MyAVLTree<int> t;
@@ -62,6 +72,56 @@ int main()
 	//rb.LevelOrder();
 	//### Test Red Black Tree - END ###
 
+	//### Benchmark Compact Node Layout - BEGIN ###
+	//myDataStructures::Benchmarks::CompactLayout(1000000);
+	//### Benchmark Compact Node Layout - END ###
+
+	//### Benchmark Concurrent Sets - BEGIN ###
+	//myDataStructures::Benchmarks::ConcurrentSets(1000000);
+	//### Benchmark Concurrent Sets - END ###
+
+	//### Benchmark Interval Overlaps - BEGIN ###
+	//myDataStructures::Benchmarks::IntervalOverlaps(1000000, 1000);
+	//### Benchmark Interval Overlaps - END ###
+
+	//### Benchmark Batched Search - BEGIN ###
+	//myDataStructures::Benchmarks::BatchedSearch(8000000, 4000000, 64);
+	//### Benchmark Batched Search - END ###
+
+	//### Benchmark Priority Queues - BEGIN ###
+	//myDataStructures::Benchmarks::PriorityQueues(1000000, 2000000);
+	//### Benchmark Priority Queues - END ###
+
+	//### Benchmark Sliding Window - BEGIN ###
+	//myDataStructures::Benchmarks::SlidingWindow(4, 10);
+	//### Benchmark Sliding Window - END ###
+
+	//### Benchmark Parallel Scan - BEGIN ###
+	//myDataStructures::Benchmarks::ParallelScan(10000000);
+	//### Benchmark Parallel Scan - END ###
+
+	//### Benchmark Relaxed Ingest - BEGIN ###
+	//myDataStructures::Benchmarks::RelaxedIngest(50000, 100);
+	//### Benchmark Relaxed Ingest - END ###
+
+	//### Benchmark Static Lookups - BEGIN ###
+	//myDataStructures::Benchmarks::StaticLookups(10000000);
+	//### Benchmark Static Lookups - END ###
+
+	//### Benchmark Teardown - BEGIN ###
+	//myDataStructures::Benchmarks::Teardown(10000000);
+	//### Benchmark Teardown - END ###
+
+	//### Record Trace - BEGIN ### (build with MYDS_ENABLE_TRACE defined)
+	//myDataStructures::Trace::Recorder::Instance().Start("rbtree.trace");
+	//MyRBTree<long long> traced;
+	//for (long long i = 0; i < 100000; i++)
+	//	traced.InsertValue(i * 7919 % 100003);
+	//for (long long i = 0; i < 100000; i++)
+	//	traced.Search(i);
+	//myDataStructures::Trace::Recorder::Instance().Stop();
+	//### Record Trace - END ###
+
 	std::cin.ignore();
 	std::cin.get();
 	return 0;
@@ -0,0 +1,220 @@
+#ifndef STATIC_SET_H
+#define STATIC_SET_H
+#include <cstddef>
+#include <stdexcept>
+
+namespace myDataStructures
+{
+	namespace StaticSet
+	{
+		// Not constexpr on purpose: reaching it while a table is built at compile time
+		// stops the build with this name in the error. At run time it throws, since the
+		// lookups would give wrong answers on keys out of order.
+		inline void KeysMustBeSortedAndUnique()
+		{
+			throw std::invalid_argument("StaticSet keys must be sorted ascending without duplicates");
+		}
+
+		// Sorted keys laid out in Eytzinger (breadth first) order: slot 1 is the root and the
+		// children of slot k are 2k and 2k+1. The first levels share a few cache lines and a
+		// lookup is a short loop of compares with no pointers to follow.
+		template<typename T, size_t N>
+		struct EytzingerLayout
+		{
+			T slots[N + 1]; // Slot 0 is unused
+
+			constexpr EytzingerLayout() : slots() {}
+
+			// Index of the first key not less than key, 0 when every key is less
+			constexpr size_t LowerBound(const T& key) const
+			{
+				// The answer is the last slot the search turned left at. Both updates are done with
+				// masks rather than ?:, which compilers like to turn back into unpredictable branches.
+				size_t found = 0;
+				size_t k = 1;
+				while (k <= N)
+				{
+					size_t less = slots[k] < key ? 1 : 0;
+					size_t keep = 0 - less; // All ones when the search turns right and found stays
+					found = (found & keep) | (k & ~keep);
+					k = 2 * k + less;
+				}
+
+				return found;
+			}
+
+			constexpr size_t IndexOf(const T& key) const
+			{
+				size_t k = LowerBound(key);
+				return k != 0 && !(key < slots[k]) ? k : 0;
+			}
+
+			template<typename F>
+			void ForEachIndexInOrder(size_t k, F& f) const
+			{
+				if (k > N)
+					return;
+
+				ForEachIndexInOrder(2 * k, f);
+				f(k);
+				ForEachIndexInOrder(2 * k + 1, f);
+			}
+		};
+
+		// Fills the layout slots with an in order walk over the implicit tree, so the sorted keys land where a search expects them
+		template<typename T, size_t N, typename Store>
+		constexpr void FillInOrder(size_t k, size_t& next, const T (&sorted)[N], Store& store)
+		{
+			if (k > N)
+				return;
+
+			FillInOrder(2 * k, next, sorted, store);
+			if (next > 0 && !(sorted[next - 1] < sorted[next]))
+				KeysMustBeSortedAndUnique();
+			store(k, next++);
+			FillInOrder(2 * k + 1, next, sorted, store);
+		}
+
+		// Read only ordered set for tables known at build time. Declared constexpr it is built by the
+		// compiler, so nothing runs at startup, and Contains/Find can be folded away for constant keys.
+		// T needs a constexpr operator< and must be a literal type.
+		template<typename T, size_t N>
+		class StaticOrderedSet
+		{
+		private:
+			EytzingerLayout<T, N> layout;
+
+			struct Store
+			{
+				StaticOrderedSet& set;
+				const T (&sorted)[N];
+
+				constexpr void operator()(size_t slot, size_t index) { set.layout.slots[slot] = sorted[index]; }
+			};
+
+		public:
+			// The keys must be sorted ascending without duplicates, or std::invalid_argument is thrown
+			constexpr explicit StaticOrderedSet(const T (&sorted)[N]) : layout()
+			{
+				size_t next = 0;
+				Store store{ *this, sorted };
+				FillInOrder(1, next, sorted, store);
+			}
+
+			constexpr size_t Size() const { return N; }
+			constexpr bool Contains(const T& key) const { return layout.IndexOf(key) != 0; }
+
+			// The stored key equal to key, nullptr if there is none
+			constexpr const T* Find(const T& key) const
+			{
+				size_t k = layout.IndexOf(key);
+				return k != 0 ? &layout.slots[k] : nullptr;
+			}
+
+			// The smallest key not less than key, nullptr if there is none
+			constexpr const T* LowerBound(const T& key) const
+			{
+				size_t k = layout.LowerBound(key);
+				return k != 0 ? &layout.slots[k] : nullptr;
+			}
+
+			template<typename F>
+			void ForEachInOrder(F&& f) const
+			{
+				auto visit = [&](size_t k) { f(layout.slots[k]); };
+				layout.ForEachIndexInOrder(1, visit);
+			}
+		};
+
+		template<typename K, typename V>
+		struct Entry
+		{
+			K key;
+			V value;
+		};
+
+		// Read only ordered map with the same layout as StaticOrderedSet. Keys and values are kept in
+		// separate arrays, so a search only touches keys and reads one value at the end.
+		template<typename K, typename V, size_t N>
+		class StaticOrderedMap
+		{
+		private:
+			EytzingerLayout<K, N> layout;
+			V values[N + 1];
+
+			struct Store
+			{
+				StaticOrderedMap& map;
+				const Entry<K, V> (&sorted)[N];
+
+				constexpr void operator()(size_t slot, size_t index)
+				{
+					map.layout.slots[slot] = sorted[index].key;
+					map.values[slot] = sorted[index].value;
+				}
+			};
+
+			// The keys alone, so FillInOrder can check the order
+			struct Keys
+			{
+				K keys[N];
+
+				constexpr explicit Keys(const Entry<K, V> (&sorted)[N]) : keys()
+				{
+					for (size_t i = 0; i < N; i++)
+						keys[i] = sorted[i].key;
+				}
+			};
+
+		public:
+			// The entries must be sorted by ascending key without duplicate keys, or std::invalid_argument is thrown
+			constexpr explicit StaticOrderedMap(const Entry<K, V> (&sorted)[N]) : layout(), values()
+			{
+				size_t next = 0;
+				Keys keys(sorted);
+				Store store{ *this, sorted };
+				FillInOrder(1, next, keys.keys, store);
+			}
+
+			constexpr size_t Size() const { return N; }
+			constexpr bool Contains(const K& key) const { return layout.IndexOf(key) != 0; }
+
+			// The value stored for key, nullptr if key is missing
+			constexpr const V* Find(const K& key) const
+			{
+				size_t k = layout.IndexOf(key);
+				return k != 0 ? &values[k] : nullptr;
+			}
+
+			// The value stored for key, fallback if key is missing
+			constexpr V FindOr(const K& key, V fallback) const
+			{
+				size_t k = layout.IndexOf(key);
+				return k != 0 ? values[k] : fallback;
+			}
+
+			template<typename F>
+			void ForEachInOrder(F&& f) const
+			{
+				auto visit = [&](size_t k) { f(layout.slots[k], values[k]); };
+				layout.ForEachIndexInOrder(1, visit);
+			}
+		};
+
+		// Deduces the type and the size from the list: constexpr auto opcodes = MakeStaticSet({ 1, 4, 9 });
+		template<typename T, size_t N>
+		constexpr StaticOrderedSet<T, N> MakeStaticSet(const T (&sorted)[N])
+		{
+			return StaticOrderedSet<T, N>(sorted);
+		}
+
+		// The size is deduced, the types are given: MakeStaticMap<int, char>({ { 1, 'a' }, { 4, 'b' } })
+		template<typename K, typename V, size_t N>
+		constexpr StaticOrderedMap<K, V, N> MakeStaticMap(const Entry<K, V> (&sorted)[N])
+		{
+			return StaticOrderedMap<K, V, N>(sorted);
+		}
+	}
+}
+
+#endif
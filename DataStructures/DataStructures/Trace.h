@@ -0,0 +1,263 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Operation tracing, compiled in only with MYDS_ENABLE_TRACE defined. Without it MYDS_TRACE is empty,
+// with it an operation costs one relaxed load until Trace::Recorder::Instance().Start() is called.
+// Containers trace in their public calls only, internal calls go through untraced helpers, so every
+// call is recorded once. Calls changing many keys, such as batch inserts, pops and range erases, are
+// recorded as one Insert or Delete per key, which a replay runs like the original call.
+#ifdef MYDS_ENABLE_TRACE
+#define MYDS_TRACE(container, op, key) ::myDataStructures::Trace::Log(::myDataStructures::Trace::Container::container, ::myDataStructures::Trace::Op::op, this, key)
+#define MYDS_TRACE_EACH(container, op, first, last) ::myDataStructures::Trace::LogEach(::myDataStructures::Trace::Container::container, ::myDataStructures::Trace::Op::op, this, first, last)
+#else
+#define MYDS_TRACE(container, op, key) ((void)0)
+#define MYDS_TRACE_EACH(container, op, first, last) ((void)0)
+#endif
+
+namespace myDataStructures
+{
+	namespace Trace
+	{
+		enum class Container : std::uint8_t { RBTree, AVLTree, LockFreeSkipList, ThreadSafeStack };
+		// EraseOne is a multiset losing one copy of a key it keeps, Delete is the key leaving the container
+		enum class Op : std::uint8_t { Insert, Delete, Search, Push, Pop, EraseOne };
+
+		// One traced operation, 32 bytes in memory and in the file
+		struct Record
+		{
+			std::uint64_t sequence; // Global order of the operations across threads
+			std::uint64_t nanoseconds; // Since Start
+			std::int64_t key; // Value pushed or popped for a stack
+			std::uint32_t instance; // Low bits of the container address, tells containers of a kind apart
+			std::uint16_t thread; // Small id given to every thread on its first record
+			Container container;
+			Op op;
+		};
+
+		const char Magic[8] = { 'M', 'Y', 'D', 'S', 'T', 'R', 'C', '1' };
+
+		// Every thread appends to its own buffer and only takes the file lock to write a full one
+		struct ThreadBuffer
+		{
+			ThreadBuffer();
+			~ThreadBuffer();
+
+			std::vector<Record> records;
+			std::uint16_t thread;
+		};
+
+		class Recorder
+		{
+		private:
+			std::atomic<bool> recording;
+			std::atomic<std::uint64_t> sequence;
+			std::atomic<std::uint16_t> nextThread;
+			std::chrono::steady_clock::time_point start;
+			std::mutex mutex;
+			std::ofstream file;
+			std::vector<ThreadBuffer*> buffers; // Every live thread buffer, drained by Stop
+
+			void WriteLocked(std::vector<Record>& records);
+
+		public:
+			static const size_t BufferRecords = 4096;
+
+			Recorder() : recording(false), sequence(0), nextThread(0) {}
+			~Recorder() { Stop(); }
+
+			Recorder(const Recorder&) = delete;
+			Recorder& operator = (const Recorder&) = delete;
+
+			static Recorder& Instance();
+
+			// Starts writing every traced operation to path, returns false when it cannot be created
+			bool Start(const std::string& path);
+			// Stops recording and writes what is still buffered. Threads still inside traced
+			// operations may lose their last records, so call it once they are quiet.
+			void Stop();
+			bool Recording() const { return recording.load(std::memory_order_relaxed); }
+
+			void Append(Container container, Op op, const void* instance, std::int64_t key);
+			void Register(ThreadBuffer* buffer);
+			void Unregister(ThreadBuffer* buffer);
+		};
+
+		inline Recorder& Recorder::Instance()
+		{
+			static Recorder recorder;
+			return recorder;
+		}
+
+		inline ThreadBuffer::ThreadBuffer() : thread(0)
+		{
+			Recorder::Instance().Register(this);
+		}
+
+		inline ThreadBuffer::~ThreadBuffer()
+		{
+			Recorder::Instance().Unregister(this);
+		}
+
+		inline ThreadBuffer& LocalBuffer()
+		{
+			thread_local ThreadBuffer buffer;
+			return buffer;
+		}
+
+		inline bool Recorder::Start(const std::string& path)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			file.open(path, std::ios::binary | std::ios::trunc);
+			if (!file)
+				return false;
+
+			std::uint32_t recordSize = sizeof(Record);
+			file.write(Magic, sizeof(Magic));
+			file.write(reinterpret_cast<const char*>(&recordSize), sizeof(recordSize));
+			sequence = 0;
+			start = std::chrono::steady_clock::now();
+			recording.store(true, std::memory_order_release);
+			return true;
+		}
+
+		inline void Recorder::Stop()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!recording.exchange(false))
+				return;
+
+			for (ThreadBuffer* buffer : buffers)
+				WriteLocked(buffer->records);
+			file.close();
+		}
+
+		inline void Recorder::WriteLocked(std::vector<Record>& records)
+		{
+			if (file.is_open() && !records.empty())
+				file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+			records.clear();
+		}
+
+		inline void Recorder::Append(Container container, Op op, const void* instance, std::int64_t key)
+		{
+			ThreadBuffer& buffer = LocalBuffer();
+			if (buffer.thread == 0)
+				buffer.thread = ++nextThread;
+
+			Record r;
+			r.sequence = sequence.fetch_add(1, std::memory_order_relaxed);
+			r.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			r.key = key;
+			r.instance = static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(instance));
+			r.thread = buffer.thread;
+			r.container = container;
+			r.op = op;
+			buffer.records.push_back(r);
+
+			if (buffer.records.size() >= BufferRecords)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				WriteLocked(buffer.records);
+			}
+		}
+
+		inline void Recorder::Register(ThreadBuffer* buffer)
+		{
+			buffer->records.reserve(BufferRecords);
+			std::lock_guard<std::mutex> lock(mutex);
+			buffers.push_back(buffer);
+		}
+
+		inline void Recorder::Unregister(ThreadBuffer* buffer)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			WriteLocked(buffer->records);
+			buffers.erase(std::find(buffers.begin(), buffers.end(), buffer));
+		}
+
+		// Only arithmetic keys are recorded, other key types leave no trace
+		template<typename T>
+		inline typename std::enable_if<std::is_arithmetic<T>::value>::type Log(Container container, Op op, const void* instance, const T& key)
+		{
+			Recorder& recorder = Recorder::Instance();
+			if (recorder.Recording())
+				recorder.Append(container, op, instance, static_cast<std::int64_t>(key));
+		}
+
+		template<typename T>
+		inline typename std::enable_if<!std::is_arithmetic<T>::value>::type Log(Container, Op, const void*, const T&)
+		{
+		}
+
+		// One record per key in [first, last), the range is not walked unless a trace is being recorded
+		template<typename It>
+		inline void LogEach(Container container, Op op, const void* instance, It first, It last)
+		{
+			if (!Recorder::Instance().Recording())
+				return;
+
+			for (; first != last; ++first)
+				Log(container, op, instance, *first);
+		}
+
+		// Stack hooks recording pushes and pops as ThreadSafeStack operations. A stack that calls
+		// Hooks::Pushed(this, value) and Hooks::Popped(this, value) under its lock, such as the
+		// ThreadSafeStack of the Threads project, is traced by taking this as its Hooks.
+		struct StackHooks
+		{
+			template<typename T>
+			static void Pushed(const void* stack, const T& value)
+			{
+#ifdef MYDS_ENABLE_TRACE
+				Log(Container::ThreadSafeStack, Op::Push, stack, value);
+#else
+				(void)stack;
+				(void)value;
+#endif
+			}
+
+			template<typename T>
+			static void Popped(const void* stack, const T& value)
+			{
+#ifdef MYDS_ENABLE_TRACE
+				Log(Container::ThreadSafeStack, Op::Pop, stack, value);
+#else
+				(void)stack;
+				(void)value;
+#endif
+			}
+		};
+
+		// Reads a trace written by Recorder, ordered by sequence. Returns false for a missing or foreign file.
+		inline bool Load(const std::string& path, std::vector<Record>& records)
+		{
+			records.clear();
+			std::ifstream file(path, std::ios::binary);
+			char magic[sizeof(Magic)];
+			std::uint32_t recordSize = 0;
+			file.read(magic, sizeof(magic));
+			file.read(reinterpret_cast<char*>(&recordSize), sizeof(recordSize));
+			if (!file || std::memcmp(magic, Magic, sizeof(Magic)) != 0 || recordSize != sizeof(Record))
+				return false;
+
+			Record r;
+			while (file.read(reinterpret_cast<char*>(&r), sizeof(r)))
+				records.push_back(r);
+
+			std::sort(records.begin(), records.end(), [](const Record& a, const Record& b) { return a.sequence < b.sequence; });
+			return true;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,367 @@
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "AVLTree.h"
+#include "CompactRBTree.h"
+#include "LockFreeSkipList.h"
+#include "RBTree.h"
+#include "Trace.h"
+
+namespace myDataStructures
+{
+	namespace TraceReplay
+	{
+		typedef long long Key;
+		typedef std::chrono::steady_clock Clock;
+
+		// Original runs every operation on the thread that recorded it and in the recorded order, so
+		// the containers go through the same states. PerThread only keeps the order within each thread
+		// and lets the threads race, which measures contention but may take different paths.
+		enum class Ordering { Original, PerThread };
+
+		struct Result
+		{
+			std::string name;
+			size_t operations;
+			size_t hits; // Operations that found or changed a key, equal across correct implementations
+			double seconds;
+			std::uint64_t p50, p90, p99, p999, max; // Nanoseconds per operation
+		};
+
+		// Targets give every container the same three calls. Apply returns whether the
+		// operation hit: the key was found, inserted, removed, or a value was popped.
+		// The targets are sets. A multiset trace replays with the same keys present after every
+		// operation: a repeated Insert misses, and EraseOne, which kept the key, is a lookup.
+		struct RBTreeTarget
+		{
+			static const bool ThreadSafe = false;
+			static const char* Name() { return "RBTree"; }
+			RBTree::RBTree<Key> set;
+
+			bool Apply(const Trace::Record& r)
+			{
+				switch (r.op)
+				{
+				case Trace::Op::Insert:
+				{
+					size_t before = set.Size();
+					set.InsertValue(r.key);
+					return set.Size() != before;
+				}
+				case Trace::Op::Delete: return set.EraseAll(r.key) != 0; // DeleteValue prints on a miss
+				case Trace::Op::EraseOne:
+				case Trace::Op::Search:
+				{
+					RBTree::Node<Key>* n = set.Search(r.key);
+					return n != nullptr && n->data == r.key;
+				}
+				default: return false;
+				}
+			}
+		};
+
+		struct AVLTreeTarget
+		{
+			static const bool ThreadSafe = false;
+			static const char* Name() { return "AVLTree"; }
+			AVLTree::AVLTree<Key> set;
+
+			bool Apply(const Trace::Record& r)
+			{
+				size_t before = set.Size();
+				switch (r.op)
+				{
+				case Trace::Op::Insert: set.Insert(r.key); return set.Size() != before;
+				case Trace::Op::Delete: set.Remove(r.key); return set.Size() != before;
+				case Trace::Op::EraseOne:
+				case Trace::Op::Search: return set.Search(r.key) != nullptr;
+				default: return false;
+				}
+			}
+		};
+
+		struct CompactRBTreeTarget
+		{
+			static const bool ThreadSafe = false;
+			static const char* Name() { return "CompactRBTree"; }
+			CompactRBTree::CompactRBTree<Key> set;
+
+			bool Apply(const Trace::Record& r)
+			{
+				size_t before = set.Size();
+				switch (r.op)
+				{
+				case Trace::Op::Insert: set.InsertValue(r.key); return set.Size() != before;
+				case Trace::Op::Delete: set.DeleteValue(r.key); return set.Size() != before;
+				case Trace::Op::EraseOne:
+				case Trace::Op::Search: return set.Contains(r.key);
+				default: return false;
+				}
+			}
+		};
+
+		struct LockFreeSkipListTarget
+		{
+			static const bool ThreadSafe = true;
+			static const char* Name() { return "LockFreeSkipList"; }
+			LockFreeSkipList::LockFreeSkipList<Key> set;
+
+			bool Apply(const Trace::Record& r)
+			{
+				switch (r.op)
+				{
+				case Trace::Op::Insert: return set.Insert(r.key);
+				case Trace::Op::Delete: return set.Remove(r.key);
+				case Trace::Op::EraseOne:
+				case Trace::Op::Search: return set.Search(r.key);
+				default: return false;
+				}
+			}
+		};
+
+		// Any stack with push(value) and try_pop(value), such as the ThreadSafeStack of the Threads project
+		template<typename Stack>
+		struct StackTarget
+		{
+			static const bool ThreadSafe = true;
+			static const char* Name() { return "ThreadSafeStack"; }
+			Stack stack;
+
+			bool Apply(const Trace::Record& r)
+			{
+				Key value;
+				switch (r.op)
+				{
+				case Trace::Op::Push: stack.push(r.key); return true;
+				case Trace::Op::Pop: return stack.try_pop(value);
+				default: return false;
+				}
+			}
+		};
+
+		// Latency percentile of sorted nanosecond samples, q in [0, 1]
+		inline std::uint64_t Percentile(const std::vector<std::uint64_t>& sorted, double q)
+		{
+			if (sorted.empty())
+				return 0;
+
+			return sorted[static_cast<size_t>(q * (sorted.size() - 1))];
+		}
+
+		// Runs the records against a fresh Target on one thread per recorded thread. Latencies
+		// only cover the operation itself, the wall time also covers waiting for the turn.
+		template<typename Target>
+		Result Replay(const std::vector<Trace::Record>& records, Ordering ordering)
+		{
+			// Operations of every recorded thread, as positions in the global order
+			std::map<std::uint16_t, std::vector<size_t>> byThread;
+			for (size_t i = 0; i < records.size(); i++)
+				byThread[records[i].thread].push_back(i);
+
+			Target target;
+			std::atomic<size_t> turn(0);
+			std::atomic<size_t> hits(0);
+			std::atomic<size_t> ready(0);
+			std::mutex mutex; // Only for unsynchronized targets raced by PerThread
+			bool locked = !Target::ThreadSafe && ordering == Ordering::PerThread && byThread.size() > 1;
+			std::vector<std::vector<std::uint64_t>> latencies(byThread.size());
+
+			auto run = [&](const std::vector<size_t>& positions, std::vector<std::uint64_t>& samples)
+			{
+				ready++;
+				while (ready.load() < byThread.size())
+					std::this_thread::yield();
+
+				samples.reserve(positions.size());
+				size_t found = 0;
+				for (size_t position : positions)
+				{
+					if (ordering == Ordering::Original)
+					{
+						while (turn.load(std::memory_order_acquire) != position)
+							std::this_thread::yield();
+					}
+
+					Clock::time_point start = Clock::now();
+					bool hit;
+					if (locked)
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						hit = target.Apply(records[position]);
+					}
+					else
+						hit = target.Apply(records[position]);
+					samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+					found += hit ? 1 : 0;
+
+					if (ordering == Ordering::Original)
+						turn.store(position + 1, std::memory_order_release);
+				}
+
+				hits += found;
+			};
+
+			Clock::time_point start = Clock::now();
+			std::vector<std::thread> workers;
+			size_t index = 0;
+			for (auto& thread : byThread)
+			{
+				if (index > 0)
+					workers.emplace_back(run, std::cref(thread.second), std::ref(latencies[index]));
+				index++;
+			}
+
+			if (!byThread.empty())
+				run(byThread.begin()->second, latencies[0]);
+			for (std::thread& worker : workers)
+				worker.join();
+
+			Result result;
+			result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			result.name = Target::Name();
+			result.operations = records.size();
+			result.hits = hits;
+
+			std::vector<std::uint64_t> all;
+			all.reserve(records.size());
+			for (std::vector<std::uint64_t>& samples : latencies)
+				all.insert(all.end(), samples.begin(), samples.end());
+			std::sort(all.begin(), all.end());
+			result.p50 = Percentile(all, 0.5);
+			result.p90 = Percentile(all, 0.9);
+			result.p99 = Percentile(all, 0.99);
+			result.p999 = Percentile(all, 0.999);
+			result.max = all.empty() ? 0 : all.back();
+			return result;
+		}
+
+		// One line per implementation, with the wall time relative to the first one
+		inline void Report(const std::vector<Result>& results)
+		{
+			for (const Result& r : results)
+			{
+				std::cout << "  " << r.name << ": " << r.operations / r.seconds / 1e6 << " Mops/s, "
+					<< r.hits << " hits, ns p50 " << r.p50 << " p90 " << r.p90 << " p99 " << r.p99
+					<< " p99.9 " << r.p999 << " max " << r.max;
+				if (&r != &results.front())
+					std::cout << ", " << (r.seconds / results.front().seconds - 1) * 100 << "% time against " << results.front().name;
+				std::cout << std::endl;
+			}
+		}
+
+		// Keeps the records of the container with the most operations, which is what a trace of one index holds
+		inline void KeepBusiestContainer(std::vector<Trace::Record>& records)
+		{
+			std::map<std::pair<Trace::Container, std::uint32_t>, size_t> counts;
+			for (const Trace::Record& r : records)
+				counts[std::make_pair(r.container, r.instance)]++;
+
+			std::pair<Trace::Container, std::uint32_t> busiest;
+			size_t most = 0;
+			for (auto& count : counts)
+			{
+				if (count.second > most)
+				{
+					busiest = count.first;
+					most = count.second;
+				}
+			}
+
+			records.erase(std::remove_if(records.begin(), records.end(), [&](const Trace::Record& r)
+			{
+				return r.container != busiest.first || r.instance != busiest.second;
+			}), records.end());
+		}
+
+		// Loads the trace at path and keeps its busiest container, printing why when nothing is left
+		inline bool LoadBusiest(const std::string& path, std::vector<Trace::Record>& records)
+		{
+			if (!Trace::Load(path, records))
+			{
+				std::cout << "Cannot read trace " << path << std::endl;
+				return false;
+			}
+
+			KeepBusiestContainer(records);
+			if (records.empty())
+			{
+				std::cout << "Trace " << path << " holds no operations" << std::endl;
+				return false;
+			}
+
+			return true;
+		}
+
+		inline void PrintHeader(const std::vector<Trace::Record>& records, Ordering ordering)
+		{
+			size_t threads = 0;
+			std::vector<bool> seen(1 << 16);
+			for (const Trace::Record& r : records)
+			{
+				if (!seen[r.thread])
+					threads++;
+				seen[r.thread] = true;
+			}
+
+			std::cout << "Replaying " << records.size() << " operations from " << threads << " threads, "
+				<< (ordering == Ordering::Original ? "original interleaving" : "per thread order") << std::endl;
+		}
+
+		// Replays a set trace at path against every set implementation and prints the comparison.
+		// Returns the exit code for main.
+		inline int Run(const std::string& path, Ordering ordering)
+		{
+			std::vector<Trace::Record> records;
+			if (!LoadBusiest(path, records))
+				return 1;
+
+			if (records.front().container == Trace::Container::ThreadSafeStack)
+			{
+				std::cout << "Trace " << path << " holds stack operations, replay it with RunStack" << std::endl;
+				return 1;
+			}
+
+			PrintHeader(records, ordering);
+			std::vector<Result> results;
+			results.push_back(Replay<RBTreeTarget>(records, ordering));
+			results.push_back(Replay<AVLTreeTarget>(records, ordering));
+			results.push_back(Replay<CompactRBTreeTarget>(records, ordering));
+			results.push_back(Replay<LockFreeSkipListTarget>(records, ordering));
+			Report(results);
+			return 0;
+		}
+
+		// Replays a stack trace at path against Stack, for programs that have a stack to measure
+		template<typename Stack>
+		int RunStack(const std::string& path, Ordering ordering)
+		{
+			std::vector<Trace::Record> records;
+			if (!LoadBusiest(path, records))
+				return 1;
+
+			if (records.front().container != Trace::Container::ThreadSafeStack)
+			{
+				std::cout << "Trace " << path << " holds set operations, replay it with Run" << std::endl;
+				return 1;
+			}
+
+			PrintHeader(records, ordering);
+			std::vector<Result> results;
+			results.push_back(Replay<StackTarget<Stack>>(records, ordering));
+			Report(results);
+			return 0;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,388 @@
+#ifndef TREE_UTILS_H
+#define TREE_UTILS_H
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Parallel.h"
+
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#define MYDS_PREFETCH(address) _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0)
+#else
+#define MYDS_PREFETCH(address) __builtin_prefetch(address)
+#endif
+
+namespace myDataStructures
+{
+	namespace TreeUtils
+	{
+		template<typename F, typename... Args>
+		inline bool VisitImpl(std::true_type, F& f, Args&&... args)
+		{
+			f(std::forward<Args>(args)...);
+			return true;
+		}
+
+		template<typename F, typename... Args>
+		inline bool VisitImpl(std::false_type, F& f, Args&&... args)
+		{
+			return static_cast<bool>(f(std::forward<Args>(args)...));
+		}
+
+		// Calls the visitor and returns whether the traversal should continue.
+		// Visitors returning void never stop it, visitors returning bool stop it by returning false.
+		template<typename F, typename... Args>
+		inline bool Visit(F& f, Args&&... args)
+		{
+			using Result = decltype(f(std::forward<Args>(args)...));
+			return VisitImpl(std::is_void<Result>(), f, std::forward<Args>(args)...);
+		}
+
+		// Collapses runs of equal values in a sorted vector. With counts the length of
+		// every run is recorded for multiset trees, without it duplicates are just dropped.
+		template<typename T>
+		void CollapseRuns(std::vector<T>& sorted, std::vector<unsigned>* counts)
+		{
+			size_t kept = 0;
+			for (size_t i = 0; i < sorted.size(); i++)
+			{
+				if (kept > 0 && !(sorted[kept - 1] < sorted[i]))
+				{
+					if (counts != nullptr)
+						(*counts)[kept - 1]++;
+					continue;
+				}
+
+				if (counts != nullptr)
+					counts->push_back(1);
+				if (kept != i)
+					sorted[kept] = sorted[i];
+				kept++;
+			}
+
+			sorted.erase(sorted.begin() + kept, sorted.end());
+		}
+
+		// Sorts a batch for the bulk inserts and collapses its runs, counting them for multiset trees
+		template<typename T>
+		void PrepareBatch(std::vector<T>& batch, std::vector<unsigned>* counts, unsigned threads)
+		{
+			if (!std::is_sorted(batch.begin(), batch.end()))
+				Parallel::Sort(batch, threads);
+
+			CollapseRuns(batch, counts);
+		}
+
+		// Whether m separate descents, O(m log n), beat rebuilding the whole tree, O(n + m)
+		inline bool DescentsCheaper(size_t batchSize, size_t size)
+		{
+			size_t logSize = 1;
+			while ((size_t(1) << logSize) < size + batchSize)
+				logSize++;
+
+			return batchSize * logSize < size;
+		}
+
+		// Adds copies to the count of a multiset node. The count saturates at NodeT::MaxCount rather
+		// than wrapping around, which could leave a node in the tree with no copies.
+		template<typename NodeT>
+		inline void AddCopies(NodeT* n, unsigned copies)
+		{
+			unsigned count = n->count;
+			n->count = copies < NodeT::MaxCount - count ? count + copies : NodeT::MaxCount;
+		}
+
+		template<typename NodeT, typename T>
+		NodeT* NewBatchNode(const std::vector<T>& batch, const std::vector<unsigned>* counts, size_t i)
+		{
+			NodeT* n = new NodeT(batch[i]);
+			if (counts != nullptr)
+				n->count = (*counts)[i] < NodeT::MaxCount ? (*counts)[i] : NodeT::MaxCount;
+			return n;
+		}
+
+		// Merges a prepared batch with the nodes under root into one list in key order, ready to be
+		// relinked. A key the tree already holds keeps its node, which in a multiset gains the batch count.
+		template<typename NodeT, typename T, typename KeyOf>
+		void MergeBatch(NodeT* root, const std::vector<T>& batch, const std::vector<unsigned>* counts, KeyOf keyOf, std::vector<NodeT*>& nodes)
+		{
+			size_t next = 0;
+			auto merge = [&](NodeT* n)
+			{
+				while (next < batch.size() && batch[next] < keyOf(n))
+					nodes.push_back(NewBatchNode<NodeT>(batch, counts, next++));
+
+				if (next < batch.size() && !(keyOf(n) < batch[next]))
+				{
+					if (counts != nullptr)
+						AddCopies(n, (*counts)[next]);
+					next++;
+				}
+
+				nodes.push_back(n);
+			};
+			ForEachNodeInSubtree(root, merge);
+
+			while (next < batch.size())
+				nodes.push_back(NewBatchNode<NodeT>(batch, counts, next++));
+		}
+
+		// Same result as MergeBatch, but the keys the tree already holds are dropped from the batch
+		// first, so the new nodes can be allocated on every thread before the two lists are merged
+		template<typename NodeT, typename T, typename KeyOf>
+		void MergeBatchParallel(NodeT* root, size_t size, std::vector<T>& batch, std::vector<unsigned>* counts, unsigned threads, KeyOf keyOf, std::vector<NodeT*>& nodes)
+		{
+			std::vector<NodeT*> existing;
+			existing.reserve(size);
+			auto collect = [&](NodeT* n) { existing.push_back(n); };
+			ForEachNodeInSubtree(root, collect);
+
+			size_t kept = 0;
+			size_t next = 0;
+			for (size_t i = 0; i < batch.size(); i++)
+			{
+				while (next < existing.size() && keyOf(existing[next]) < batch[i])
+					next++;
+
+				if (next < existing.size() && !(batch[i] < keyOf(existing[next])))
+				{
+					if (counts != nullptr)
+						AddCopies(existing[next], (*counts)[i]);
+					continue;
+				}
+
+				if (counts != nullptr)
+					(*counts)[kept] = (*counts)[i];
+				batch[kept++] = batch[i];
+			}
+			batch.resize(kept);
+
+			std::vector<NodeT*> added(batch.size());
+			Parallel::For(batch.size(), threads, [&](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+					added[i] = NewBatchNode<NodeT>(batch, counts, i);
+			});
+
+			nodes.resize(existing.size() + added.size());
+			std::merge(existing.begin(), existing.end(), added.begin(), added.end(), nodes.begin(),
+				[&](NodeT* a, NodeT* b) { return keyOf(a) < keyOf(b); });
+		}
+
+		// Morris walks thread the right link of a predecessor back to its successor while they are
+		// inside its left subtree. This finishes such a walk from current without visiting anything,
+		// until the threads still in place are all removed and the tree has its shape back.
+		template<typename NodeT>
+		void RemoveMorrisThreads(NodeT* current, size_t threads)
+		{
+			while (threads > 0 && current != nullptr)
+			{
+				if (current->left == nullptr)
+				{
+					current = current->right;
+					continue;
+				}
+
+				NodeT* predecessor = current->left;
+				while (predecessor->right != nullptr && predecessor->right != current)
+					predecessor = predecessor->right;
+
+				if (predecessor->right == nullptr)
+				{
+					predecessor->right = current;
+					current = current->left;
+					threads++;
+				}
+				else
+				{
+					predecessor->right = nullptr;
+					threads--;
+					current = current->right;
+				}
+			}
+		}
+
+		// Leaves the tree intact however a Morris walk ends: after an early exit, and when the visitor throws
+		template<typename NodeT>
+		struct MorrisGuard
+		{
+			NodeT*& current;
+			size_t& threads;
+
+			~MorrisGuard()
+			{
+				if (threads > 0)
+					RemoveMorrisThreads(current, threads);
+			}
+		};
+
+		// A piece of a tree for the parallel walks: a whole subtree, or a single node above the subtrees
+		template<typename NodeT>
+		struct SubtreeChunk
+		{
+			NodeT* node;
+			bool whole;
+		};
+
+		template<typename NodeT, typename F>
+		void ForEachNodeInSubtree(NodeT* n, F& f)
+		{
+			if (n == nullptr)
+				return;
+
+			ForEachNodeInSubtree(n->left, f);
+			f(n);
+			ForEachNodeInSubtree(n->right, f);
+		}
+
+		template<typename NodeT, typename F>
+		void ForEachNodeInChunk(const SubtreeChunk<NodeT>& chunk, F& f)
+		{
+			if (chunk.whole)
+				ForEachNodeInSubtree(chunk.node, f);
+			else
+				f(chunk.node);
+		}
+
+		// Visits every key of the chunks on the shared task pool, in no particular order
+		template<typename NodeT, typename F, typename KeyOf>
+		void ParallelForEachChunk(const std::vector<SubtreeChunk<NodeT>>& chunks, unsigned threads, F& f, KeyOf keyOf)
+		{
+			Parallel::TaskPool::Shared().Run(chunks.size(), Parallel::ThreadCount(threads), [&](size_t i, unsigned)
+			{
+				auto visit = [&](NodeT* n) { f(keyOf(n)); };
+				ForEachNodeInChunk(chunks[i], visit);
+			});
+		}
+
+		// Folds every key of the chunks with op. Ordered keeps one partial per chunk and merges them in key
+		// order, so op only needs to be associative. Otherwise every thread folds whatever chunks it picks
+		// up into its own partial, which needs op to be commutative too but allocates less.
+		template<typename NodeT, typename R, typename Op, typename KeyOf>
+		R ParallelReduceChunks(const std::vector<SubtreeChunk<NodeT>>& chunks, unsigned threads, R identity, Op& op, KeyOf keyOf, bool ordered)
+		{
+			threads = Parallel::ThreadCount(threads);
+			std::vector<R> partials(ordered ? chunks.size() : threads, identity);
+			Parallel::TaskPool::Shared().Run(chunks.size(), threads, [&](size_t i, unsigned participant)
+			{
+				R& partial = partials[ordered ? i : participant];
+				R accumulated = std::move(partial);
+				auto fold = [&](NodeT* n) { accumulated = op(std::move(accumulated), keyOf(n)); };
+				ForEachNodeInChunk(chunks[i], fold);
+				partial = std::move(accumulated);
+			});
+
+			R result = identity;
+			for (const R& partial : partials)
+				result = op(std::move(result), partial);
+
+			return result;
+		}
+
+		// Frees nodes of the subtree under n without recursion, so any shape is safe for the stack. A node
+		// with a left child is rotated right until the top has none, then the top is freed and the walk
+		// moves to its right child. Stops after steps rotations and frees, leaving n at what is left
+		// (nullptr once done), and returns how many nodes it freed. Only the child links are used.
+		template<typename NodeT>
+		size_t FreeNodes(NodeT*& n, size_t steps)
+		{
+			size_t freed = 0;
+			for (; n != nullptr && steps > 0; steps--)
+			{
+				if (n->left != nullptr)
+				{
+					NodeT* l = n->left;
+					n->left = l->right;
+					l->right = n;
+					n = l;
+				}
+				else
+				{
+					NodeT* r = n->right;
+					delete n;
+					freed++;
+					n = r;
+				}
+			}
+
+			return freed;
+		}
+
+		// Frees the whole subtree under n and returns its node count
+		template<typename NodeT>
+		size_t FreeSubtree(NodeT* n)
+		{
+			size_t freed = 0;
+			while (n != nullptr)
+				freed += FreeNodes(n, static_cast<size_t>(-1));
+
+			return freed;
+		}
+
+		// Lookups kept in flight at once by InterleavedSearch, enough to cover a memory round trip
+		const size_t SearchLanes = 16;
+
+		// Exact match lookups for many keys at once. Each lane walks one key a level per round and
+		// prefetches the child it moves to, so the cache misses of all lanes overlap instead of
+		// queuing one after the other. A lane that finishes picks up the next key right away.
+		// results[i] is the node holding keys[i] or nullptr, keyOf reads the key of a node.
+		template<typename NodeT, typename T, typename KeyOf>
+		void InterleavedSearch(NodeT* root, const std::vector<T>& keys, std::vector<NodeT*>& results, KeyOf keyOf)
+		{
+			results.assign(keys.size(), nullptr);
+			if (root == nullptr)
+				return;
+
+			NodeT* cursor[SearchLanes];
+			size_t keyIndex[SearchLanes];
+			size_t lanes = 0;
+			size_t next = 0;
+			while (lanes < SearchLanes && next < keys.size())
+			{
+				cursor[lanes] = root;
+				keyIndex[lanes++] = next++;
+			}
+
+			while (lanes > 0)
+			{
+				for (size_t lane = 0; lane < lanes;)
+				{
+					NodeT* n = cursor[lane];
+					const T& key = keys[keyIndex[lane]];
+					if (key < keyOf(n))
+						n = n->left;
+					else if (keyOf(n) < key)
+						n = n->right;
+					else
+					{
+						results[keyIndex[lane]] = n;
+						n = nullptr;
+					}
+
+					if (n != nullptr)
+					{
+						MYDS_PREFETCH(n);
+						cursor[lane++] = n;
+						continue;
+					}
+
+					// Done with this key, reuse the lane for the next one or close it
+					if (next < keys.size())
+					{
+						cursor[lane] = root;
+						keyIndex[lane++] = next++;
+					}
+					else
+					{
+						lanes--;
+						cursor[lane] = cursor[lanes];
+						keyIndex[lane] = keyIndex[lanes];
+					}
+				}
+			}
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef THREAD_SAFE_STACK_H
+#define THREAD_SAFE_STACK_H
+#include <stack>
+#include <mutex>
+#include <memory>
+
+// Hooks called under the stack lock after every push and pop, so they see the real order.
+// The default does nothing; a tracer passes its own, such as myDataStructures::Trace::StackHooks.
+struct NoStackHooks {
+	template <typename T>
+	static void Pushed(const void*, const T&) {}
+
+	template <typename T>
+	static void Popped(const void*, const T&) {}
+};
+
+template <typename T, typename Hooks = NoStackHooks>
+class ThreadSafeStack {
+private:
+	std::stack<T> st;
+	mutable std::mutex mut;
+
+public:
+	ThreadSafeStack() {}
+
+	ThreadSafeStack(const ThreadSafeStack& other) {
+		std::lock_guard<std::mutex> lk(other.mut);
+		st = other.st;
+	}
+
+	ThreadSafeStack operator = (const ThreadSafeStack&) = delete;
+
+	void push(T value) {
+		std::lock_guard<std::mutex> lk(mut);
+		st.push(value);
+		Hooks::Pushed(this, value);
+	}
+
+	std::shared_ptr<T> pop() {
+		std::lock_guard<std::mutex> lk(mut);
+		auto const ptr = std::shared_ptr<T>(std::move(st.top()));
+		st.pop();
+		Hooks::Popped(this, *ptr);
+		return ptr;
+	}
+
+	void pop(T& value) {
+		std::lock_guard<std::mutex> lk(mut);
+		value = std::move(st.top());
+		st.pop();
+		Hooks::Popped(this, value);
+	}
+
+	// Returns false instead of popping an empty stack
+	bool try_pop(T& value) {
+		std::lock_guard<std::mutex> lk(mut);
+		if (st.empty())
+			return false;
+
+		value = std::move(st.top());
+		st.pop();
+		Hooks::Popped(this, value);
+		return true;
+	}
+
+	bool empty() const {
+		std::lock_guard<std::mutex> lk(mut);
+		return st.empty();
+	}
+};
+
+#endif